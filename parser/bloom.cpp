@@ -0,0 +1,165 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include "bloom.h"
+#include "misc.h"
+
+using namespace std;
+
+namespace {
+
+  // The sidecar is a native endian dump of the following header, followed by
+  // the filter blocks.
+  struct BloomHeader {
+    uint64_t magic;
+    uint64_t bookSize; // Size of the indexed .bin, to detect a stale sidecar
+    uint64_t keys;
+    uint64_t blocks;   // Number of 512 bit blocks
+    uint64_t hashes;   // Number of bits set per key
+  };
+
+  const uint64_t BloomMagic = 0x31544C4642444343ULL;
+  const int BlockWords = 8;
+
+  // set_or_test() sets or tests the bits of a key. The block is selected by a
+  // first hash, the bit positions inside it by double hashing a second one.
+  template<bool Set>
+  bool set_or_test(uint64_t* bits, const uint64_t* cbits, uint64_t blocks,
+                   uint64_t hashes, Key key) {
+
+    uint64_t block = mix(key, 0) % blocks * BlockWords;
+    uint64_t g = mix(key, 1);
+    uint32_t a = uint32_t(g), b = uint32_t(g >> 32) | 1;
+
+    for (uint64_t i = 0; i < hashes; ++i, a += b)
+    {
+        uint64_t w = block + (a & 511) / 64;
+        uint64_t bit = 1ULL << (a & 63);
+
+        if (Set)
+            bits[w] |= bit;
+
+        else if (!(cbits[w] & bit))
+            return false;
+    }
+
+    return true;
+  }
+
+} // namespace
+
+
+BloomFilter::~BloomFilter() { close(); }
+
+
+/// sidecar() returns the file name of the filter sidecar of a given book
+
+string BloomFilter::sidecar(const string& bookName) {
+
+  size_t lastdot = bookName.find_last_of(".");
+  return bookName.substr(0, lastdot) + ".flt";
+}
+
+
+/// build() writes a filter over the given keys, sized for the requested false
+/// positive rate. The optimal classic Bloom filter needs log2(1/fpr) / ln(2)
+/// bits per key, blocking costs a few percent more for the same rate. Returns
+/// the size of the written sidecar.
+
+size_t BloomFilter::build(const vector<Key>& keys, double fpr,
+                          uint64_t bookSize, const string& fName) {
+
+  double bitsPerKey = 1.1 * -log(fpr) / (log(2) * log(2));
+
+  BloomHeader h = BloomHeader();
+  h.magic = BloomMagic;
+  h.bookSize = bookSize;
+  h.keys = keys.size();
+  h.blocks = max(uint64_t(1), uint64_t(ceil(bitsPerKey * keys.size() / 512)));
+  h.hashes = min(16, max(1, int(round(log(2) * bitsPerKey / 1.1))));
+
+  vector<uint64_t> bits(h.blocks * BlockWords);
+
+  for (Key k : keys)
+      set_or_test<true>(bits.data(), nullptr, h.blocks, h.hashes, k);
+
+  // A book being opened meanwhile sees no filter, rather than part of one
+  ofstream ofs(fName + ".tmp", ofstream::out | ofstream::binary);
+  ofs.write((const char*)&h, sizeof(h));
+  ofs.write((const char*)bits.data(), bits.size() * sizeof(uint64_t));
+
+  size_t size = ofs.tellp();
+  ofs.close();
+  return replace_file(fName + ".tmp", fName) ? size : 0;
+}
+
+
+/// open() maps a sidecar built for a book of the given size. A missing,
+/// corrupted or stale sidecar is silently ignored.
+
+bool BloomFilter::open(const string& fName, uint64_t bookSize) {
+
+  close();
+
+  ifstream ifs(fName, ifstream::in | ifstream::binary);
+  BloomHeader h;
+
+  if (   !ifs.read((char*)&h, sizeof(h))
+      || h.magic != BloomMagic
+      || h.bookSize != bookSize
+      || !h.blocks)
+      return false;
+
+  ifs.close();
+  if (!map(fName.c_str(), &baseAddress, &mapping, &size))
+      return false;
+
+  if (size != sizeof(h) + h.blocks * BlockWords * sizeof(uint64_t))
+  {
+      close();
+      return false;
+  }
+
+  blocks = h.blocks;
+  hashes = h.hashes;
+  bits = (const uint64_t*)((const char*)baseAddress + sizeof(h));
+  return true;
+}
+
+void BloomFilter::close() {
+
+  if (baseAddress)
+      unmap(baseAddress, mapping);
+
+  baseAddress = nullptr;
+}
+
+
+/// may_contain() returns false if the key is certainly not in the book. If the
+/// filter is not open, every key may be in the book.
+
+bool BloomFilter::may_contain(Key key) const {
+
+  return !baseAddress || set_or_test<false>(nullptr, bits, blocks, hashes, key);
+}
@@ -0,0 +1,52 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BLOOM_H_INCLUDED
+#define BLOOM_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+/// BloomFilter is a blocked Bloom filter over the keys of a book, stored in a
+/// memory mapped sidecar file next to the .bin. All the bits of a key fall in
+/// the same 512 bit block, so that a query costs a single cache line (or page)
+/// access. A negative answer is always right, so find() can skip the book.
+
+class BloomFilter {
+public:
+ ~BloomFilter();
+  static size_t build(const std::vector<Key>& keys, double fpr,
+                      uint64_t bookSize, const std::string& fName);
+  static std::string sidecar(const std::string& bookName);
+
+  bool open(const std::string& fName, uint64_t bookSize);
+  void close();
+  bool may_contain(Key key) const;
+
+private:
+  void* baseAddress = nullptr;
+  uint64_t mapping = 0, size = 0;
+  uint64_t blocks, hashes;
+  const uint64_t* bits;
+};
+
+#endif // #ifndef BLOOM_H_INCLUDED
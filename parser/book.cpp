@@ -25,95 +25,228 @@
 
 #include <algorithm>
 #include <cassert>
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <mutex>
 
 #include "book.h"
 #include "misc.h"
 
 using namespace std;
 
-PolyglotBook::~PolyglotBook() { if (is_open()) close(); }
+namespace {
 
+  // Book entries are stored in big-endian format
+  template<typename T> T read_be(const uint8_t* data) {
 
-/// operator>>() reads sizeof(T) chars from the file's binary byte stream and
-/// converts them into a number of type T. A Polyglot book stores numbers in
-/// big-endian format.
+    T n = 0;
+    for (size_t i = 0; i < sizeof(T); ++i)
+        n = T((n << 8) + data[i]);
 
-template<typename T> PolyglotBook& PolyglotBook::operator>>(T& n) {
+    return n;
+  }
 
-  n = 0;
-  for (size_t i = 0; i < sizeof(T); ++i)
-      n = T((n << 8) + ifstream::get());
+  // Posting lists are sorted by 'learn' in books that have a .len sidecar
+  // matching their size. Books built before have none, and their results
+  // are counted one entry at a time.
+  bool postings_sorted(const string& fName, uint64_t size) {
 
-  return *this;
-}
+    ifstream len(fName.substr(0, fName.find_last_of('.')) + ".len");
+    uint64_t pgnSize, resume, bookSize;
 
-template<> PolyglotBook& PolyglotBook::operator>>(PolyEntry& e) {
-  return *this >> e.key >> e.move >> e.weight >> e.learn;
-}
+    return len >> pgnSize >> resume >> bookSize && bookSize == size;
+  }
 
+} // namespace
 
-/// open() tries to open a book file with the given name after closing any
-/// existing one.
+MappedBook::~MappedBook() { close(); }
 
-bool PolyglotBook::open(const char* fName) {
 
-  if (is_open()) // Cannot close an already closed file
-      close();
+/// open() maps a book file with the given name after unmapping any existing
+/// one. An empty book is valid and has no entries. Sidecars built for this very
+/// book are mapped too, stale ones are ignored. Returns false if the book can
+/// not be opened or mapped.
 
-  ifstream::open(fName, ifstream::in | ifstream::binary);
+bool MappedBook::open(const string& fName) {
 
-  fileName = is_open() ? fName : "";
-  ifstream::clear(); // Reset any error flag to allow a retry ifstream::open()
-  return !fileName.empty();
+  close();
+
+  if (!ifstream(fName).is_open())
+      return false;
+
+  uint64_t size = file_size(fName);
+  if (size >= SizeOfPolyEntry)
+  {
+      void* base;
+      if (!::map(fName.c_str(), &base, &mapping, &size))
+          return false;
+
+      baseAddress = base;
+      data = (const uint8_t*)base;
+      entries = size / SizeOfPolyEntry;
+  }
+
+  postingsSorted = postings_sorted(fName, size);
+
+  static std::atomic<uint64_t> lastId(0);
+
+  mapId = ++lastId;
+  mph.open(MinimalPerfectHash::sidecar(fName), size, file_time(fName));
+  filter.open(BloomFilter::sidecar(fName), size);
+  hot.open(HotTable::sidecar(fName), size);
+  return true;
 }
 
+void MappedBook::close() {
 
-/// probe() tries to find a book move for the given position
+  if (baseAddress)
+      unmap(baseAddress, mapping);
 
-size_t PolyglotBook::probe(Key key, const string& fName, bool* found) {
+  baseAddress = nullptr;
+  data = nullptr;
+  entries = 0;
+  mph.close();
+  filter.close();
+  hot.close();
+}
 
-  if (fileName != fName && !open(fName.c_str()))
-      return 0;
+Key MappedBook::key(size_t idx) const {
 
-  size_t ofs = find_first(key, found);
-  close();
-  return ofs;
+  assert(idx < entries);
+  return read_be<Key>(data + idx * SizeOfPolyEntry);
 }
 
+PolyEntry MappedBook::operator[](size_t idx) const {
 
-/// find_first() takes a book key as input, and does a binary search through
-/// the book file for the given key. Returns the index of the leftmost book
-/// entry with the same key as the input.
+  assert(idx < entries);
+  const uint8_t* d = data + idx * SizeOfPolyEntry;
+  return { read_be<PKey>(d), read_be<PMove>(d + 8), read_be<uint16_t>(d + 10), read_be<uint32_t>(d + 12) };
+}
+
+
+/// find() returns the index of the leftmost entry with the given key, or size()
+/// if there is none. Keys rejected by the filter do not touch the book at all,
+/// otherwise the hash sidecar, if any, saves the binary search.
+
+size_t MappedBook::find(Key k) const {
+
+  if (!entries || !may_contain(k))
+      return entries;
+
+  bool found = true;
+  size_t idx = mph.is_open() ? mph.probe(k, &found) : lower_bound(k);
+
+  return found && idx < entries && key(idx) == k ? idx : entries;
+}
 
-size_t PolyglotBook::find_first(Key key, bool* found) {
 
-  seekg(0, ios::end); // Move pointer to end, so tellg() gets file's size
+/// gallop() returns the index of the first entry not less than the given key,
+/// searching from the entry at index 'from' on. Steps double until the key is
+/// passed, so that the cost is logarithmic in the distance from 'from' rather
+/// than in the size of the book: for sorted keys a whole batch of lookups
+/// becomes a single forward sweep.
 
-  size_t ofs, low = 0, mid, high = (size_t)tellg() / SizeOfPolyEntry - 1;
-  PolyEntry e = PolyEntry();
+size_t MappedBook::gallop(Key k, size_t from) const {
 
-  assert(low <= high);
+  size_t low = from, high = from, step = 1;
 
-  while (low < high && good())
+  while (high < entries && key(high) < k)
   {
-      mid = (low + high) / 2;
+      low = high + 1;
+      high += step;
+      step *= 2;
+  }
 
-      assert(mid >= low && mid < high);
+  return search(k, low, std::min(high, entries));
+}
 
-      seekg(mid * SizeOfPolyEntry, ios_base::beg);
-      *this >> e;
+size_t MappedBook::search(Key k, size_t low, size_t high) const {
 
-      if (key <= e.key)
-          high = mid;
-      else
+  while (low < high)
+  {
+      size_t mid = (low + high) / 2;
+
+      if (key(mid) < k)
           low = mid + 1;
+      else
+          high = mid;
   }
 
-  assert(low == high);
-
-  ofs = low * SizeOfPolyEntry;
-  seekg(ofs, std::ios_base::beg);
-  *this >> e;
-  *found = key == e.key;
-  return ofs;
+  return low;
 }
+
+
+namespace Books {
+
+  namespace {
+
+    typedef std::array<uint64_t, 6> Stamp;
+
+    struct Mapped {
+      std::shared_ptr<const MappedBook> book;
+      Stamp stamp;
+    };
+
+    std::mutex mutex;
+    std::map<string, Mapped> registry;
+
+    // A book is mapped again when it or any of its sidecars has changed
+    Stamp stamp(const string& fName) {
+      return { file_size(fName), file_time(fName),
+               file_time(MinimalPerfectHash::sidecar(fName)),
+               file_time(BloomFilter::sidecar(fName)),
+               file_time(HotTable::sidecar(fName)),
+               file_time(fName.substr(0, fName.find_last_of('.')) + ".len") };
+    }
+
+  } // namespace
+
+
+  /// Books::open() returns the book with the given name, mapping it on first
+  /// use and keeping it mapped for later queries. A book that changed on disk
+  /// since it was mapped, sidecars included, is mapped again as a new
+  /// generation: queries still running on the old one keep it alive through
+  /// their shared pointer. The new generation is mapped out of the lock, so
+  /// that queries on any book never wait for it. A missing book has no entries,
+  /// one that exists but cannot be mapped is returned as a null pointer.
+
+  std::shared_ptr<const MappedBook> open(const string& fName) {
+
+    Stamp s = stamp(fName);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        const Mapped& m = registry[fName];
+
+        if (m.book && m.stamp == s)
+            return m.book;
+    }
+
+    std::shared_ptr<MappedBook> book = std::make_shared<MappedBook>();
+    if (!book->open(fName) && ifstream(fName).is_open())
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Mapped& m = registry[fName];
+
+    // Another query may have mapped the same generation meanwhile
+    if (!m.book || m.stamp != s)
+        m = { book, s };
+
+    return m.book;
+  }
+
+
+  /// Books::mapped() returns the number of books currently in the registry
+
+  size_t mapped() {
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return registry.size();
+  }
+
+} // namespace Books
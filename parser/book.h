@@ -20,24 +20,61 @@
 #ifndef BOOK_H_INCLUDED
 #define BOOK_H_INCLUDED
 
-#include <fstream>
+#include <memory>
 #include <string>
 
+#include "bloom.h"
+#include "hot.h"
 #include "misc.h"
+#include "mph.h"
 #include "position.h"
 
-class PolyglotBook : private std::ifstream {
+/// MappedBook gives random access to the entries of a memory mapped book,
+/// together with its hash, filter and hot table sidecars when present. Lookups of single
+/// keys go through the sidecars, bulk lookups are better done by a forward
+/// sweep over the sorted entries rather than one binary search per key. Each
+/// open() gets a distinct id, so that results derived from a book can be told
+/// apart from those of a rebuilt one.
+
+class MappedBook {
 public:
- ~PolyglotBook();
-  size_t probe(Key key, const std::string& fName, bool* found);
+  MappedBook() = default;
+  MappedBook(const MappedBook&) = delete;
+  MappedBook& operator=(const MappedBook&) = delete;
+ ~MappedBook();
 
-private:
-  template<typename T> PolyglotBook& operator>>(T& n);
+  bool open(const std::string& fName);
+  void close();
+  uint64_t id() const { return mapId; }
+  size_t size() const { return entries; }
+  Key key(size_t idx) const;
+  PolyEntry operator[](size_t idx) const;
+  bool may_contain(Key key) const { return filter.may_contain(key); }
+  size_t find(Key key) const;
+  size_t lower_bound(Key key) const { return search(key, 0, entries); }
+  size_t gallop(Key key, size_t from) const;
+  const HotTable& hot_table() const { return hot; }
+  bool sorted_postings() const { return postingsSorted; }
 
-  bool open(const char* fName);
-  size_t find_first(Key key, bool* found);
+private:
+  size_t search(Key key, size_t low, size_t high) const;
 
-  std::string fileName;
+  void* baseAddress = nullptr;
+  uint64_t mapping = 0;
+  const uint8_t* data = nullptr;
+  size_t entries = 0;
+  uint64_t mapId = 0;
+  bool postingsSorted = true;
+  MinimalPerfectHash mph;
+  BloomFilter filter;
+  HotTable hot;
 };
 
+namespace Books {
+
+  std::shared_ptr<const MappedBook> open(const std::string& fName);
+  size_t mapped();
+
+} // namespace Books
+
 #endif // #ifndef BOOK_H_INCLUDED
@@ -0,0 +1,143 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CACHE_H_INCLUDED
+#define CACHE_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+/// LruCache is a bounded cache that evicts the least recently used entries.
+/// It is split in shards, each with its own lock and its own LRU list, so that
+/// threads looking up different keys seldom wait for each other. Eviction is
+/// then only approximately global LRU, which is fine for a cache.
+
+template<typename K, typename V, typename Hash>
+class LruCache {
+
+  static const size_t ShardNb = 16;
+
+  struct Shard {
+    std::mutex mutex;
+    std::list<std::pair<K, V>> lru; // Most recently used first
+    std::unordered_map<K, typename std::list<std::pair<K, V>>::iterator, Hash> map;
+  };
+
+public:
+  explicit LruCache(size_t entries) { resize(entries); }
+
+  /// get() copies the value of the key to 'value' and marks it as recently
+  /// used. Returns false if the key is not cached.
+  bool get(const K& key, V& value) {
+
+    Shard& s = shard(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    auto it = s.map.find(key);
+    if (it == s.map.end())
+    {
+        misses++;
+        return false;
+    }
+
+    hits++;
+    s.lru.splice(s.lru.begin(), s.lru, it->second);
+    value = it->second->second;
+    return true;
+  }
+
+  /// contains() tells whether the key is cached, without counting a lookup
+  /// nor marking it as recently used.
+  bool contains(const K& key) {
+
+    Shard& s = shard(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.map.count(key);
+  }
+
+  /// put() caches a value, evicting the least recently used entry of the shard
+  /// if it is full.
+  void put(const K& key, const V& value) {
+
+    Shard& s = shard(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    if (!perShard)
+        return;
+
+    auto it = s.map.find(key);
+    if (it != s.map.end())
+    {
+        it->second->second = value;
+        s.lru.splice(s.lru.begin(), s.lru, it->second);
+        return;
+    }
+
+    if (s.map.size() >= perShard)
+    {
+        s.map.erase(s.lru.back().first);
+        s.lru.pop_back();
+    }
+
+    s.lru.emplace_front(key, value);
+    s.map[key] = s.lru.begin();
+  }
+
+  /// resize() sets the capacity, 0 disables the cache. Entries are dropped.
+  void resize(size_t entries) {
+
+    for (Shard& s : shards)
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.lru.clear();
+        s.map.clear();
+    }
+
+    perShard = (entries + ShardNb - 1) / ShardNb;
+  }
+
+  size_t capacity() const { return perShard * ShardNb; }
+
+  size_t size() {
+
+    size_t n = 0;
+    for (Shard& s : shards)
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        n += s.map.size();
+    }
+    return n;
+  }
+
+  std::atomic<uint64_t> hits{0}, misses{0};
+
+private:
+  // High bits pick the shard, so that they do not correlate with the buckets
+  Shard& shard(const K& key) { return shards[(uint64_t(Hash()(key)) >> 40) % ShardNb]; }
+
+  Shard shards[ShardNb];
+  std::atomic<size_t> perShard{0};
+};
+
+#endif // #ifndef CACHE_H_INCLUDED
@@ -4,6 +4,7 @@ import json
 import os
 import pexpect
 import re
+import socket
 import subprocess
 from pexpect.popen_spawn import PopenSpawn
 
@@ -42,26 +43,132 @@ class Parser:
         self.pgn = ''
         self.db = ''
 
-    def make(self, full=True):
-        '''Make an index out of a pgn file'''
+    def make(self, full=True, wait=True, hot=None, append=False, follow=False,
+             checkpoint=None, resume=False):
+        '''Make an index out of a pgn file. If not wait, the index is built in
+           the background and a job id is returned, to be passed to status.
+           With hot=(positions, games), the answers of the most frequent
+           positions are precomputed. With append, only the games added to
+           the pgn file since the index was made are parsed. With checkpoint,
+           the pgn file is parsed that many MBytes at a time, leaving a
+           checkpoint a build with resume goes on from. With follow, a job id
+           is returned at once, of a job that ingests the games added to the
+           pgn file as they are written, until unfollow'''
         if not self.pgn:
             raise NameError("Unknown DB, first open a PGN file")
         cmd = 'book ' + self.pgn
         if full:
             cmd += ' full'
+        if hot:
+            cmd += ' hot {} {}'.format(*hot)
+        if append:
+            cmd += ' append'
+        if checkpoint:
+            cmd += ' checkpoint {}'.format(checkpoint)
+        if resume:
+            cmd += ' resume'
+        if follow:
+            cmd += ' follow'
+        elif not wait:
+            cmd += ' async'
         self.p.sendline(cmd)
         self.wait_ready()
-        s = '{' + self.p.before.split('{')[1]
+        s = '{' + self.p.before.split('{', 1)[1]
         s = s.replace('\\', r'\\')  # Escape Windows's path delimiter
         result = json.loads(s)
         self.p.before = ''
+        return result if wait and not follow else result['Job']
+
+    def unfollow(self):
+        '''Stop the job following the pgn file'''
+        self.p.sendline('book {} unfollow'.format(self.pgn))
+        self.wait_ready()
+        self.p.before = ''
+
+    def ingest(self, flush=None):
+        '''Index the games added to the pgn file since the last call into a
+           live index, searched by find along with the index made out of the
+           pgn file. With flush, the in-memory games are written to disk every
+           flush entries'''
+        if not self.pgn:
+            raise NameError("Unknown DB, first open a PGN file")
+        cmd = 'ingest ' + self.pgn
+        if flush:
+            cmd += ' flush {}'.format(flush)
+        self.p.sendline(cmd)
+        self.wait_ready()
+        s = '{' + self.p.before.split('{', 1)[1]
+        result = json.loads(s)
+        self.p.before = ''
         return result
 
-    def find(self, fen, limit=10, skip=0):
-        '''Find all games with positions equal to fen'''
+    def status(self, job):
+        '''Progress of a background index build: stage, bytes parsed, games
+           and ETA, and the result of make once the stage is "done"'''
+        self.p.sendline('status {}'.format(job))
+        self.wait_ready()
+        s = self.p.before.replace('\\', r'\\')
+        result = json.loads(s)
+        self.p.before = ''
+        return result
+
+    def find(self, fen, limit=10, skip=0, cursor=''):
+        '''Find all games with positions equal to fen. When a result has a
+           'cursor', pass it back, instead of fen, to get the next page'''
         if not self.db:
             raise NameError("Unknown DB, first open a PGN file")
-        cmd = "find {} limit {} skip {} {}".format(self.db, limit, skip, fen)
+        if cursor:
+            cmd = "find {} limit {} cursor {}".format(self.db, limit, cursor)
+        else:
+            cmd = "find {} limit {} skip {} {}".format(self.db, limit, skip, fen)
+        self.p.sendline(cmd)
+        self.wait_ready()
+        result = json.loads(self.p.before)
+        self.p.before = ''
+        return result
+
+    def stats(self):
+        '''Number of mapped books and hit rate of the find results cache'''
+        self.p.sendline('stats')
+        self.wait_ready()
+        result = json.loads(self.p.before)
+        self.p.before = ''
+        return result
+
+    def find_batch(self, fens, limit=10, skip=0):
+        '''Find all games for each position in the fens list, in a single
+           sweep over the DB. Book keys can be passed instead of FEN strings'''
+        if not self.db:
+            raise NameError("Unknown DB, first open a PGN file")
+        cmd = "findbatch {} limit {} skip {}".format(self.db, limit, skip)
+        self.p.sendline(cmd)
+        for fen in fens:
+            self.p.sendline(str(fen))
+        self.p.sendline('end')
+        self.wait_ready()
+        result = json.loads(self.p.before)
+        self.p.before = ''
+        return result
+
+    def explore(self, fen, limit=10, skip=0):
+        '''Same as find, plus the statistics of the positions reached by
+           each legal move, whatever the move played there'''
+        if not self.db:
+            raise NameError("Unknown DB, first open a PGN file")
+        cmd = "explore {} limit {} skip {} {}".format(self.db, limit, skip, fen)
+        self.p.sendline(cmd)
+        self.wait_ready()
+        result = json.loads(self.p.before)
+        self.p.before = ''
+        return result
+
+    def find_line(self, moves, fen=''):
+        '''Count the games reaching each position along a line of moves in
+           coordinate notation, from fen or from the starting position'''
+        if not self.db:
+            raise NameError("Unknown DB, first open a PGN file")
+        start = 'fen ' + fen if fen else 'startpos'
+        cmd = "findline {} {} moves {}".format(self.db, start, ' '.join(moves))
         self.p.sendline(cmd)
         self.wait_ready()
         result = json.loads(self.p.before)
@@ -119,3 +226,50 @@ class Parser:
             h = self.get_header(pgn)
             headers.append(h)
         return headers
+
+
+class Client:
+    '''Connect to a parser started with "serve <socket path>", that keeps
+       books mapped across queries, instead of spawning one per query'''
+    def __init__(self, path):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+        self.f = self.sock.makefile('rw')
+        self.latency = 0
+
+    def query(self, cmd):
+        '''Send a command and return its JSON result. The time taken by the
+           server, in usec, is stored in latency'''
+        self.f.write(cmd + '\n')
+        self.f.flush()
+        lines = []
+        while True:
+            line = self.f.readline()
+            if not line:
+                raise EOFError("Connection closed by the server")
+            status = line.split(' ', 2)
+            if status[0] in ('ok', 'error'):
+                self.latency = int(status[1])
+                if status[0] == 'error':
+                    raise ValueError(status[2].strip())
+                return json.loads(''.join(lines))
+            lines.append(line)
+
+    def find(self, db, fen, limit=10, skip=0):
+        return self.query("find {} limit {} skip {} {}".format(db, limit, skip, fen))
+
+    def explore(self, db, fen, limit=10, skip=0):
+        return self.query("explore {} limit {} skip {} {}".format(db, limit, skip, fen))
+
+    def find_line(self, db, moves, fen=''):
+        start = 'fen ' + fen if fen else 'startpos'
+        return self.query("findline {} {} moves {}".format(db, start, ' '.join(moves)))
+
+    def stats(self):
+        return self.query('stats')
+
+    def close(self, shutdown=False):
+        '''Close the connection, also stopping the server if shutdown'''
+        self.f.write('shutdown\n' if shutdown else 'quit\n')
+        self.f.flush()
+        self.sock.close()
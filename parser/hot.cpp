@@ -0,0 +1,201 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <fstream>
+#include <queue>
+
+#include "book.h"
+#include "hot.h"
+
+using namespace std;
+
+namespace {
+
+  // The sidecar is a native endian dump of the following header, followed by
+  // the positions sorted by key, their moves and the game offsets of the moves.
+  struct HotHeader {
+    uint64_t magic;
+    uint64_t bookSize; // Size of the indexed .bin, to detect a stale sidecar
+    uint64_t positions;
+    uint64_t moves;
+    uint64_t offsets;
+    uint64_t games;    // Game offsets stored per move, at most
+  };
+
+  const uint64_t HotMagic = 0x31544F4842444343ULL;
+
+  inline size_t words(size_t bytes) { return (bytes + 7) / 8; }
+
+} // namespace
+
+
+/// sidecar() returns the file name of the hot table sidecar of a given book
+
+string HotTable::sidecar(const string& bookName) {
+
+  size_t lastdot = bookName.find_last_of(".");
+  return bookName.substr(0, lastdot) + ".hot";
+}
+
+
+/// build() writes the hot table of the 'positions' keys with the most entries,
+/// i.e. reached by the most games in a full book, keeping the first 'games'
+/// offsets of each move. A first sweep selects the keys with a bounded heap, a
+/// second one visits only the selected positions. Returns the size of the
+/// written sidecar.
+
+size_t HotTable::build(const MappedBook& book, size_t positions, size_t games,
+                       uint64_t bookSize, const string& fName) {
+
+  typedef pair<size_t, size_t> Run; // Number of entries, index of the first one
+
+  priority_queue<Run, vector<Run>, greater<Run>> top;
+
+  for (size_t idx = 0, end; idx < book.size(); idx = end)
+  {
+      Key key = book.key(idx);
+      for (end = idx + 1; end < book.size() && book.key(end) == key; ++end) {}
+
+      if (top.size() < positions)
+          top.push(Run(end - idx, idx));
+
+      else if (positions && end - idx > top.top().first)
+      {
+          top.pop();
+          top.push(Run(end - idx, idx));
+      }
+  }
+
+  vector<size_t> firsts;
+  for ( ; !top.empty(); top.pop())
+      firsts.push_back(top.top().second);
+
+  sort(firsts.begin(), firsts.end()); // Book order is key order
+
+  vector<Position> posTable;
+  vector<Move> moveTable;
+  vector<uint32_t> offsetTable;
+
+  for (size_t idx : firsts)
+  {
+      Key key = book.key(idx);
+      posTable.push_back({ key, uint32_t(moveTable.size()), 0 });
+
+      for (size_t end; idx < book.size() && book.key(idx) == key; idx = end)
+      {
+          PolyEntry e = book[idx];
+          Move m = { e.move, e.weight, 0, 0, 0, 0, uint32_t(offsetTable.size()) };
+          uint32_t results[4] = {};
+
+          // Posting lists are sorted by result, then by game offset
+          for (end = idx; end < book.size() && book.key(end) == key && book[end].move == e.move; ++end)
+          {
+              uint32_t learn = book[end].learn;
+              results[(learn >> 30) & 3]++;
+
+              if (end - idx < games)
+                  offsetTable.push_back(learn & 0x3FFFFFFF);
+          }
+
+          m.games = uint32_t(end - idx);
+          m.wins = results[0];
+          m.losses = results[1];
+          m.draws = results[2];
+          moveTable.push_back(m);
+          posTable.back().moves++;
+      }
+  }
+
+  HotHeader h = HotHeader();
+  h.magic = HotMagic;
+  h.bookSize = bookSize;
+  h.positions = posTable.size();
+  h.moves = moveTable.size();
+  h.offsets = offsetTable.size();
+  h.games = games;
+
+  offsetTable.resize(words(offsetTable.size() * sizeof(uint32_t)) * 2);
+
+  ofstream ofs(fName + ".tmp", ofstream::out | ofstream::binary);
+  ofs.write((const char*)&h, sizeof(h));
+  ofs.write((const char*)posTable.data(), posTable.size() * sizeof(Position));
+  ofs.write((const char*)moveTable.data(), moveTable.size() * sizeof(Move));
+  ofs.write((const char*)offsetTable.data(), offsetTable.size() * sizeof(uint32_t));
+
+  size_t size = ofs.tellp();
+  ofs.close();
+  return replace_file(fName + ".tmp", fName) ? size : 0;
+}
+
+
+/// open() reads in memory a sidecar built for a book of the given size. A
+/// missing, corrupted or stale sidecar is silently ignored.
+
+bool HotTable::open(const string& fName, uint64_t bookSize) {
+
+  close();
+
+  ifstream ifs(fName, ifstream::in | ifstream::binary);
+  HotHeader h;
+
+  if (   !ifs.read((char*)&h, sizeof(h))
+      || h.magic != HotMagic
+      || h.bookSize != bookSize)
+      return false;
+
+  size_t posWords = words(h.positions * sizeof(Position));
+  size_t moveWords = words(h.moves * sizeof(Move));
+  data.resize(posWords + moveWords + words(h.offsets * sizeof(uint32_t)));
+
+  if (   !ifs.read((char*)data.data(), data.size() * sizeof(uint64_t))
+      || ifs.peek() != EOF)
+  {
+      close();
+      return false;
+  }
+
+  positions = h.positions;
+  games = h.games;
+  positionTable = (const Position*)data.data();
+  moveTable = (const Move*)(data.data() + posWords);
+  offsetTable = (const uint32_t*)(data.data() + posWords + moveWords);
+  return true;
+}
+
+void HotTable::close() {
+
+  data.clear();
+  data.shrink_to_fit();
+  positions = 0;
+}
+
+
+/// probe() returns the precomputed position with the given key, or nullptr if
+/// the key is not among the hot ones.
+
+const HotTable::Position* HotTable::probe(Key key) const {
+
+  const Position* end = positionTable + positions;
+  const Position* p = std::lower_bound(positionTable, end, key,
+                                       [](const Position& x, Key k) { return x.key < k; });
+
+  return p != end && p->key == key ? p : nullptr;
+}
@@ -0,0 +1,72 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HOT_H_INCLUDED
+#define HOT_H_INCLUDED
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+class MappedBook;
+
+/// HotTable holds the precomputed answers of the most frequent positions of a
+/// book: for each of them the moves in book order, their result counts and
+/// the first game offsets of each move. It is stored in a sidecar next to the
+/// .bin and read in memory when the book is opened, so that queries on the
+/// openings everybody looks at never touch the book itself.
+
+class HotTable {
+public:
+  struct Move {
+    uint16_t move, weight;
+    uint32_t games, wins, losses, draws;
+    uint32_t offset; // Index of the first game offset of the move
+  };
+
+  struct Position {
+    Key key;
+    uint32_t move;   // Index of the first move of the position
+    uint32_t moves;
+  };
+
+  static size_t build(const MappedBook& book, size_t positions, size_t games,
+                      uint64_t bookSize, const std::string& fName);
+  static std::string sidecar(const std::string& bookName);
+
+  bool open(const std::string& fName, uint64_t bookSize);
+  void close();
+  const Position* probe(Key key) const;
+  const Move* moves(const Position& pos) const { return moveTable + pos.move; }
+  const uint32_t* offsets(const Move& m) const { return offsetTable + m.offset; }
+  size_t stored(const Move& m) const { return std::min(size_t(m.games), games); }
+  size_t size() const { return positions; }
+
+private:
+  std::vector<uint64_t> data;
+  size_t positions = 0, games = 0;
+  const Position* positionTable = nullptr;
+  const Move* moveTable = nullptr;
+  const uint32_t* offsetTable = nullptr;
+};
+
+#endif // #ifndef HOT_H_INCLUDED
@@ -30,6 +30,7 @@ namespace PSQT {
 
 namespace Parser {
     void init();
+    void shutdown();
 }
 
 int main(int argc, char* argv[]) {
@@ -38,5 +39,6 @@ int main(int argc, char* argv[]) {
     Position::init();
     Parser::init();
     UCI::loop(argc, argv);
+    Parser::shutdown();
     return 0;
 }
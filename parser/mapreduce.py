@@ -0,0 +1,65 @@
+#!/usr/bin/env python
+
+'''Build the book of a PGN file with several processes: each one indexes the
+   games starting in its own byte range of the file into a run, then the runs
+   are merged into the book by reduce. With --check, the book is compared with
+   the one of a single process build.'''
+
+import argparse
+import json
+import multiprocessing
+import os
+import subprocess
+import time
+
+
+def build(path, pgn, jobs, full):
+    size = os.path.getsize(pgn)
+    bounds = [size * i // jobs for i in range(jobs + 1)]
+    start = time.time()
+    procs = [subprocess.Popen([path, 'book', pgn, 'range', str(a), str(b)],
+                              stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+             for a, b in zip(bounds, bounds[1:])]
+    runs = [json.loads(p.communicate()[0])['Book file'] for p in procs]
+    mapped = time.time()
+    book = os.path.splitext(pgn)[0] + '.bin'
+    cmd = [path, 'reduce', book] + runs + (['full'] if full else [])
+    result = json.loads(subprocess.check_output(cmd))
+    for run in runs:
+        os.remove(run)
+    return result, mapped - start, time.time() - mapped
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('pgn', help='PGN file to index')
+    parser.add_argument('--path', default='./parser', help='path to the parser')
+    parser.add_argument('--jobs', type=int, default=multiprocessing.cpu_count(),
+                        help='number of processes, one byte range each')
+    parser.add_argument('--full', action='store_true', help='build a full book')
+    parser.add_argument('--check', action='store_true',
+                        help='compare with a single process build')
+    args = parser.parse_args()
+
+    result, map_time, reduce_time = build(args.path, args.pgn, args.jobs, args.full)
+    print('{} processes: map {:.2f}s, reduce {:.2f}s, {} entries'.format(
+          args.jobs, map_time, reduce_time, result['Entries']))
+
+    if args.check:
+        book = result['Book file']
+        with open(book, 'rb') as f:
+            reduced = f.read()
+        start = time.time()
+        cmd = [args.path, 'book', args.pgn] + (['full'] if args.full else [])
+        subprocess.check_output(cmd, stderr=subprocess.DEVNULL)
+        print('1 process: {:.2f}s'.format(time.time() - start))
+        with open(book, 'rb') as f:
+            same = f.read() == reduced
+        print('Books are ' + ('identical' if same else 'DIFFERENT'))
+        return 0 if same else 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    exit(main())
@@ -18,7 +18,26 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <cstdio>
 #include <iostream>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+#else
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
 
 #include "misc.h"
 
@@ -41,3 +60,210 @@ void dbg_print() {
       cerr << "Total " << means[0] << " Mean "
            << (double)means[1] / means[0] << endl;
 }
+
+
+/// map() memory maps a whole file in read-only mode. Returns false, with the
+/// output arguments untouched, if the file cannot be mapped.
+
+bool map(const char* fname, void** baseAddress, uint64_t* mapping, uint64_t* size) {
+
+#ifndef _WIN32
+    struct stat statbuf;
+    int fd = ::open(fname, O_RDONLY);
+    if (fd < 0 || fstat(fd, &statbuf))
+    {
+        if (fd >= 0)
+            ::close(fd);
+        return false;
+    }
+    void* base = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED)
+        return false;
+    *baseAddress = base;
+    *mapping = *size = statbuf.st_size;
+    return true;
+#else
+    HANDLE fd = CreateFile(fname, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fd == INVALID_HANDLE_VALUE)
+        return false;
+    DWORD size_high;
+    DWORD size_low = GetFileSize(fd, &size_high);
+    HANDLE mmap = CreateFileMapping(fd, nullptr, PAGE_READONLY, size_high, size_low, nullptr);
+    CloseHandle(fd);
+    if (!mmap)
+        return false;
+    void* base = MapViewOfFile(mmap, FILE_MAP_READ, 0, 0, 0);
+    if (!base)
+    {
+        CloseHandle(mmap);
+        return false;
+    }
+    *baseAddress = base;
+    *mapping = (uint64_t)mmap;
+    *size = ((size_t)size_high << 32) | (size_t)size_low;
+    return true;
+#endif
+}
+
+void unmap(void* baseAddress, uint64_t mapping) {
+
+#ifndef _WIN32
+    munmap(baseAddress, mapping);
+#else
+    UnmapViewOfFile(baseAddress);
+    CloseHandle((HANDLE)mapping);
+#endif
+}
+
+/// file_size() returns the size of a file without opening it, or 0 if the file
+/// does not exist.
+
+uint64_t file_size(const std::string& fname) {
+
+#ifndef _WIN32
+    struct stat statbuf;
+    return stat(fname.c_str(), &statbuf) ? 0 : statbuf.st_size;
+#else
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!GetFileAttributesExA(fname.c_str(), GetFileExInfoStandard, &fad))
+        return 0;
+
+    return ((uint64_t)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+#endif
+}
+
+/// file_time() returns the last modification time of a file in nsec since the
+/// Unix epoch, or 0 if the file does not exist.
+
+uint64_t file_time(const std::string& fname) {
+
+#ifndef _WIN32
+    struct stat statbuf;
+    if (stat(fname.c_str(), &statbuf))
+        return 0;
+
+#if defined(__linux__)
+    return statbuf.st_mtim.tv_sec * 1000000000ULL + statbuf.st_mtim.tv_nsec;
+#else
+    return statbuf.st_mtime * 1000000000ULL;
+#endif
+#else
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!GetFileAttributesExA(fname.c_str(), GetFileExInfoStandard, &fad))
+        return 0;
+
+    // FILETIME counts 100 nsec intervals since 1601
+    return 100 * ((((uint64_t)fad.ftLastWriteTime.dwHighDateTime << 32) | fad.ftLastWriteTime.dwLowDateTime)
+                  - 116444736000000000ULL);
+#endif
+}
+
+
+/// replace_file() renames a file written under a temporary name over the given
+/// one. Readers that open the file see either the old or the new one, never a
+/// partly written one, and readers that have the old one mapped keep it.
+
+bool replace_file(const std::string& tmpName, const std::string& fname) {
+
+#ifndef _WIN32
+    return !std::rename(tmpName.c_str(), fname.c_str());
+#else
+    return MoveFileExA(tmpName.c_str(), fname.c_str(), MOVEFILE_REPLACE_EXISTING);
+#endif
+}
+
+
+/// FileWatch::wait() returns true when the file may have changed since the
+/// last call, false when 'msec' elapsed without a change. A watch lost because
+/// the file was replaced is set again, checking the file meanwhile.
+
+FileWatch::FileWatch(const std::string& fName)
+  : name(fName), size(file_size(fName)), time(file_time(fName)) {
+
+#ifdef __linux__
+  fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+FileWatch::~FileWatch() {
+
+#ifdef __linux__
+  if (fd >= 0)
+      ::close(fd);
+#endif
+}
+
+bool FileWatch::wait(int msec) {
+
+#ifdef __linux__
+  const uint32_t Events = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+  char events[4096];
+
+  if (fd >= 0 && inotify_add_watch(fd, name.c_str(), Events) >= 0) // Same watch if set
+  {
+      pollfd pfd = { fd, POLLIN, 0 };
+
+      if (::poll(&pfd, 1, msec) <= 0)
+          return false;
+
+      while (::read(fd, events, sizeof(events)) > 0) {}
+      return true;
+  }
+#endif
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(msec));
+
+  uint64_t s = file_size(name), t = file_time(name);
+  bool changed = s != size || t != time;
+  size = s, time = t;
+  return changed;
+}
+
+
+/// json_string() quotes and escapes a string to be output as a JSON value.
+/// PGN files are often Latin-1 encoded, so bytes that are not part of a valid
+/// UTF-8 sequence are taken as Latin-1 characters, to always output UTF-8.
+
+std::string json_string(const std::string& str) {
+
+    std::string out = "\"";
+
+    for (size_t i = 0; i < str.size(); ++i)
+    {
+        unsigned char c = str[i];
+        size_t len = c < 0x80 ? 1 : c >= 0xC2 && c < 0xE0 ? 2 : c >= 0xE0 && c < 0xF5 ? 3 + (c >= 0xF0) : 0;
+        size_t n = 1;
+
+        while (n < len && i + n < str.size() && (str[i + n] & 0xC0) == 0x80)
+            ++n;
+
+        if (len > 1 && n == len)
+        {
+            out += str.substr(i, len);
+            i += len - 1;
+            continue;
+        }
+
+        switch (c)
+        {
+        case '"' : out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c < 0x20 || c >= 0x80)
+            {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            }
+            else
+                out += c;
+        }
+    }
+
+    return out + "\"";
+}
@@ -32,6 +32,12 @@
 const std::string engine_info(bool to_uci = false);
 void prefetch(void* addr);
 void start_logger(const std::string& fname);
+bool map(const char* fname, void** baseAddress, uint64_t* mapping, uint64_t* size);
+void unmap(void* baseAddress, uint64_t mapping);
+uint64_t file_size(const std::string& fname);
+uint64_t file_time(const std::string& fname);
+bool replace_file(const std::string& tmpName, const std::string& fname);
+std::string json_string(const std::string& str);
 
 void dbg_hit_on(bool b);
 void dbg_hit_on(bool c, bool b);
@@ -45,6 +51,39 @@ inline TimePoint now() {
         (std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
+/// mix() is the 64 bit finalizer of MurmurHash3, with a seed to get independent
+/// hash functions. Polyglot keys are already random, but hash structures must
+/// not derive all their hashes from the same key bits.
+
+inline uint64_t mix(uint64_t key, uint64_t seed) {
+
+  uint64_t h = key ^ (seed * 0x9E3779B97F4A7C15ULL);
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  return h ^ (h >> 33);
+}
+
+/// FileWatch waits for a file to change: through inotify on Linux, elsewhere,
+/// or when inotify is not available, by polling its size and modification time.
+
+class FileWatch {
+public:
+  explicit FileWatch(const std::string& fName);
+ ~FileWatch();
+  FileWatch(const FileWatch&) = delete;
+  FileWatch& operator=(const FileWatch&) = delete;
+
+  bool wait(int msec);
+  bool polling() const { return fd < 0; }
+
+private:
+  std::string name;
+  int fd = -1;
+  uint64_t size, time;
+};
+
 template<class Entry, int Size>
 struct HashTable {
   Entry* operator[](Key key) { return &table[(uint32_t)key & (Size - 1)]; }
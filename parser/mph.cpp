@@ -0,0 +1,264 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+
+#include "bitboard.h"
+#include "misc.h"
+#include "mph.h"
+
+using namespace std;
+
+/// The sidecar is a native endian dump of the following header, followed by
+/// the level bit arrays, the rank directory, the keys that could not be placed
+/// in any level, the first entry indices and the fingerprints. It is meant to
+/// be rebuilt on the machine that serves the book, never shipped around.
+
+struct MphHeader {
+  uint64_t magic;
+  uint64_t bookSize;  // Size and modification time of the indexed .bin, to
+  uint64_t bookTime;  // detect a stale sidecar
+  uint64_t keys;      // Number of unique keys, i.e. of slots
+  uint64_t words;     // Total size of the level bit arrays, in 64 bit words
+  uint64_t fallback;  // Number of keys that did not settle in any level
+  uint64_t levels;
+  uint64_t levelOfs[32];
+  uint64_t levelWords[32];
+};
+
+namespace {
+
+  const uint64_t MphMagic = 0x32485048504D4443ULL;
+  const int MaxLevels = 32;
+  const int BlockWords = 8; // Rank directory granularity, 512 bits
+
+  inline uint16_t fingerprint(Key key) {
+    return uint16_t(mix(key, MaxLevels) >> 48);
+  }
+
+} // namespace
+
+
+MinimalPerfectHash::~MinimalPerfectHash() { close(); }
+
+
+/// sidecar() returns the file name of the hash sidecar of a given book
+
+string MinimalPerfectHash::sidecar(const string& bookName) {
+
+  size_t lastdot = bookName.find_last_of(".");
+  return bookName.substr(0, lastdot) + ".mph";
+}
+
+
+/// build() constructs the hash over the given sorted, unique keys. At each
+/// level the remaining keys are hashed into a bit array twice their number:
+/// keys landing alone in a bit settle there, colliding ones are retried at the
+/// next level. The slot of a key is the rank of its bit in the concatenation
+/// of all levels. Returns the size of the written sidecar.
+
+size_t MinimalPerfectHash::build(const vector<Key>& keys, const vector<uint64_t>& firsts,
+                                 uint64_t bookSize, uint64_t bookTime, const string& fName) {
+
+  assert(keys.size() == firsts.size());
+
+  MphHeader h = MphHeader();
+  vector<uint64_t> bits;
+  vector<Key> cur = keys, next;
+
+  h.magic = MphMagic;
+  h.bookSize = bookSize;
+  h.bookTime = bookTime;
+  h.keys = keys.size();
+
+  for ( ; h.levels < MaxLevels && !cur.empty(); ++h.levels)
+  {
+      size_t words = (2 * cur.size() + 63) / 64;
+      vector<uint64_t> seen(words), collided(words);
+
+      for (Key k : cur)
+      {
+          uint64_t p = mix(k, h.levels) % (words * 64);
+          uint64_t b = 1ULL << (p & 63);
+
+          if (seen[p / 64] & b)
+              collided[p / 64] |= b;
+          else
+              seen[p / 64] |= b;
+      }
+
+      for (size_t i = 0; i < words; ++i)
+          seen[i] &= ~collided[i];
+
+      next.clear();
+      for (Key k : cur)
+      {
+          uint64_t p = mix(k, h.levels) % (words * 64);
+          if (!(seen[p / 64] & (1ULL << (p & 63))))
+              next.push_back(k);
+      }
+
+      h.levelOfs[h.levels] = bits.size();
+      h.levelWords[h.levels] = words;
+      bits.insert(bits.end(), seen.begin(), seen.end());
+      swap(cur, next);
+  }
+
+  h.words = bits.size();
+  h.fallback = cur.size(); // Still sorted, as keys were
+
+  vector<uint64_t> ranks(h.words / BlockWords + 1);
+  for (size_t i = 0, cnt = 0; i < h.words; ++i)
+  {
+      if (i % BlockWords == 0)
+          ranks[i / BlockWords] = cnt;
+
+      cnt += popcount(bits[i]);
+  }
+
+  // Now that the levels are fixed, fill the slots through the hash itself
+  MinimalPerfectHash mph;
+  mph.header = &h;
+  mph.bits = bits.data();
+  mph.ranks = ranks.data();
+  mph.fallback = cur.data();
+
+  vector<uint64_t> slotFirsts(h.keys);
+  vector<uint16_t> slotPrints(h.keys);
+
+  for (size_t i = 0; i < keys.size(); ++i)
+  {
+      uint64_t s = mph.slot(keys[i]);
+      slotFirsts[s] = firsts[i];
+      slotPrints[s] = fingerprint(keys[i]);
+  }
+
+  // Written aside, so that the book is never opened with a partial sidecar
+  ofstream ofs(fName + ".tmp", ofstream::out | ofstream::binary);
+  ofs.write((const char*)&h, sizeof(h));
+  ofs.write((const char*)bits.data(), bits.size() * sizeof(uint64_t));
+  ofs.write((const char*)ranks.data(), ranks.size() * sizeof(uint64_t));
+  ofs.write((const char*)cur.data(), cur.size() * sizeof(Key));
+  ofs.write((const char*)slotFirsts.data(), slotFirsts.size() * sizeof(uint64_t));
+  ofs.write((const char*)slotPrints.data(), slotPrints.size() * sizeof(uint16_t));
+
+  size_t size = ofs.tellp();
+  ofs.close();
+  return replace_file(fName + ".tmp", fName) ? size : 0;
+}
+
+
+/// open() maps a sidecar built for a book of the given size and modification
+/// time. A missing, corrupted or stale sidecar is silently ignored.
+
+bool MinimalPerfectHash::open(const string& fName, uint64_t bookSize, uint64_t bookTime) {
+
+  close();
+
+  ifstream ifs(fName, ifstream::in | ifstream::binary);
+  MphHeader h;
+
+  if (   !ifs.read((char*)&h, sizeof(h))
+      || h.magic != MphMagic
+      || h.bookSize != bookSize
+      || h.bookTime != bookTime)
+      return false;
+
+  ifs.close();
+  if (!map(fName.c_str(), &baseAddress, &mapping, &size))
+      return false;
+
+  const char* data = (const char*)baseAddress;
+  header = (const MphHeader*)data;
+  bits = (const uint64_t*)(data += sizeof(MphHeader));
+  ranks = (const uint64_t*)(data += h.words * sizeof(uint64_t));
+  fallback = (const Key*)(data += (h.words / BlockWords + 1) * sizeof(uint64_t));
+  firsts = (const uint64_t*)(data += h.fallback * sizeof(Key));
+  fingerprints = (const uint16_t*)(data += h.keys * sizeof(uint64_t));
+
+  if ((const char*)(fingerprints + h.keys) != (const char*)baseAddress + size)
+  {
+      close();
+      return false;
+  }
+
+  return true;
+}
+
+void MinimalPerfectHash::close() {
+
+  if (baseAddress)
+      unmap(baseAddress, mapping);
+
+  baseAddress = nullptr;
+}
+
+
+/// slot() returns the slot of the given key, or keys() if the key is certainly
+/// not in the book. Any other key maps to some, unrelated, slot.
+
+uint64_t MinimalPerfectHash::slot(Key key) const {
+
+  for (uint64_t l = 0; l < header->levels; ++l)
+  {
+      uint64_t p = mix(key, l) % (header->levelWords[l] * 64);
+      uint64_t w = header->levelOfs[l] + p / 64;
+      uint64_t b = 1ULL << (p & 63);
+
+      if (bits[w] & b)
+      {
+          uint64_t s = ranks[w / BlockWords] + popcount(bits[w] & (b - 1));
+          for (uint64_t i = w - w % BlockWords; i < w; ++i)
+              s += popcount(bits[i]);
+
+          return s;
+      }
+  }
+
+  const Key* end = fallback + header->fallback;
+  const Key* k = std::lower_bound(fallback, end, key);
+  return k != end && *k == key ? header->keys - header->fallback + (k - fallback)
+                               : header->keys;
+}
+
+
+/// probe() returns the index of the first book entry with the given key. When
+/// the key is not in the book, 'found' is false with probability 1 - 2^-16,
+/// so callers must still check the key of the returned entry.
+
+uint64_t MinimalPerfectHash::probe(Key key, bool* found) const {
+
+  uint64_t s = slot(key);
+  *found = s < header->keys && fingerprints[s] == fingerprint(key);
+  return *found ? firsts[s] : 0;
+}
+
+size_t MinimalPerfectHash::keys() const {
+  return header->keys;
+}
+
+/// hash_bits() returns the size of the hash function itself, in bits, that is
+/// without the stored first entry indices and fingerprints.
+
+size_t MinimalPerfectHash::hash_bits() const {
+  return 64 * (header->words + header->words / BlockWords + 1 + header->fallback);
+}
@@ -0,0 +1,64 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MPH_H_INCLUDED
+#define MPH_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+struct MphHeader;
+
+/// MinimalPerfectHash is a BBHash-style minimal perfect hash over the unique
+/// keys of a book, stored in a memory mapped sidecar file next to the .bin.
+/// Every key is mapped to a distinct slot that stores the index of the first
+/// book entry with that key, plus a 16 bit fingerprint used to reject, with
+/// high probability, keys that are not in the book.
+
+class MinimalPerfectHash {
+public:
+ ~MinimalPerfectHash();
+  static size_t build(const std::vector<Key>& keys, const std::vector<uint64_t>& firsts,
+                      uint64_t bookSize, uint64_t bookTime, const std::string& fName);
+  static std::string sidecar(const std::string& bookName);
+
+  bool open(const std::string& fName, uint64_t bookSize, uint64_t bookTime);
+  void close();
+  bool is_open() const { return baseAddress != nullptr; }
+  uint64_t probe(Key key, bool* found) const;
+  size_t keys() const;
+  size_t hash_bits() const;
+
+private:
+  uint64_t slot(Key key) const;
+
+  void* baseAddress = nullptr;
+  uint64_t mapping = 0, size = 0;
+  const MphHeader* header;
+  const uint64_t* bits;
+  const uint64_t* ranks;
+  const Key* fallback;
+  const uint64_t* firsts;
+  const uint16_t* fingerprints;
+};
+
+#endif // #ifndef MPH_H_INCLUDED
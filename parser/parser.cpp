@@ -19,30 +19,32 @@
 */
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
+#include <deque>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 #include <sstream>
+#include <thread>
 
-#ifndef _WIN32
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#else
-#define WIN32_LEAN_AND_MEAN
-#ifndef NOMINMAX
-#define NOMINMAX
-#endif
-#include <windows.h>
-#endif
-
+#include "bloom.h"
 #include "book.h"
+#include "cache.h"
 #include "misc.h"
+#include "movegen.h"
+#include "mph.h"
 #include "position.h"
+#include "thread.h"
 #include "uci.h"
 
 namespace {
@@ -53,8 +55,103 @@ struct Stats {
     int64_t games;
     int64_t moves;
     int64_t fixed;
+    uint64_t resume; // Where parsing can resume if more games are appended
+    bool clean;      // False if the last game was cut short, then it cannot
+};
+
+enum Stage {
+    PARSING, SORTING, WRITING, FILTERING, FOLLOWING, DONE, FAILED, STAGE_NB
+};
+
+const char* StageNames[STAGE_NB] = {
+    "parsing", "sorting", "writing", "filtering", "following", "done", "failed"
+};
+
+// Progress of a book build, polled by "status" while the build runs. Counters
+// are updated once per game, so that keeping them costs nothing. Diagnostics
+// go to 'log', that is discarded for builds running in the background.
+struct Progress {
+    std::atomic<uint64_t> bytes, size, games;
+    std::atomic<int> stage;
+    std::ostream* log;
+};
+
+// A book build running on its own thread. Output and error are written before
+// the stage is set to DONE or FAILED, and only read after. A job following a
+// PGN file runs until stopped, and reports its ingest lag meanwhile.
+struct Job {
+   ~Job() { stop = true; if (th.joinable()) th.join(); } // Pending builds are waited by shutdown()
+
+    std::string pgnName, target, output, error;
+    std::ostream nullLog{nullptr};
+    Progress progress;
+    TimePoint start, elapsed;
+    bool follow = false;
+    std::atomic<bool> stop{false};
+    std::atomic<TimePoint> lag{0};
+    std::thread th;
+};
+
+std::mutex JobsMutex;
+std::map<int, std::unique_ptr<Job>> Jobs;
+std::set<std::string> Building; // Targets of synchronous builds, guarded by JobsMutex
+
+// Options of a book build, as given to "book"
+struct BuildOptions {
+    bool full, append;
+    double fpr;                        // Filter false positive rate, 0 for none
+    size_t hotPositions, hotGames;
+    int shardBits;                     // 0 for a single book
+    uint64_t rangeStart, rangeEnd;     // Byte range of the games, for a run
+    uint64_t checkpoint;               // Bytes parsed between checkpoints, 0 for none
+    bool resume;
+    int maxPly;                        // Plies indexed per game, 0 for all
+    size_t minGames;                   // Games a move is kept from, 0 for any
+    bool archive;                      // Write the games to a .cdb archive
+};
+
+const uint64_t DefaultCheckpoint = 256 << 20;
+
+// A find result is cached by book mapping, position key and page. The FEN is
+// not cached, as it depends on the move counters of the query, not on the key.
+struct FindKey {
+    uint64_t book, key, limit, skip;
+
+    bool operator==(const FindKey& k) const {
+        return book == k.book && key == k.key && limit == k.limit && skip == k.skip;
+    }
 };
 
+struct FindKeyHash {
+    size_t operator()(const FindKey& k) const {
+        return mix(k.key ^ (k.limit << 32) ^ k.skip, k.book);
+    }
+};
+
+// Statistics of a book move, with a page of its games as stored in 'learn',
+// i.e. result in the upper 2 bits and game offset divided by 8. When merged
+// over several books, 'books' holds the book of each game.
+struct MoveStats {
+    PMove move;
+    uint16_t weight;
+    uint64_t games, wins, losses, draws;
+    std::vector<uint32_t> offsets;
+    std::vector<size_t> books;
+};
+
+struct FindResult {
+    std::vector<std::string> moves;
+    bool more;
+};
+
+LruCache<FindKey, FindResult, FindKeyHash> FindCache(4096);
+
+// Queries answered out of the hot table of a book, without probing the book
+std::atomic<uint64_t> HotHits(0);
+
+// Results put in the cache by prefetch(), ahead of any query for them
+std::atomic<uint64_t> Prefetches(0);
+
 enum Token {
     T_NONE, T_SPACES, T_RESULT, T_MINUS, T_DOT, T_QUOTES, T_DOLLAR,
     T_LEFT_BRACKET, T_RIGHT_BRACKET, T_LEFT_BRACE, T_RIGHT_BRACE,
@@ -82,55 +179,7 @@ Token ToToken[256];
 Step ToStep[STATE_NB][TOKEN_NB];
 Position RootPos;
 
-void map(const char* fname, void** baseAddress, uint64_t* mapping, uint64_t* size) {
-
-#ifndef _WIN32
-    struct stat statbuf;
-    int fd = ::open(fname, O_RDONLY);
-    fstat(fd, &statbuf);
-    *mapping = *size = statbuf.st_size;
-    *baseAddress = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
-    ::close(fd);
-    if (*baseAddress == MAP_FAILED)
-    {
-        std::cerr << "Could not mmap() " << fname << std::endl;
-        exit(1);
-    }
-#else
-    HANDLE fd = CreateFile(fname, GENERIC_READ, FILE_SHARE_READ, nullptr,
-                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
-    DWORD size_high;
-    DWORD size_low = GetFileSize(fd, &size_high);
-    HANDLE mmap = CreateFileMapping(fd, nullptr, PAGE_READONLY, size_high, size_low, nullptr);
-    CloseHandle(fd);
-    if (!mmap)
-    {
-        std::cerr << "CreateFileMapping() failed" << std::endl;
-        exit(1);
-    }
-    *size = ((size_t)size_high << 32) | (size_t)size_low;
-    *mapping = (uint64_t)mmap;
-    *baseAddress = MapViewOfFile(mmap, FILE_MAP_READ, 0, 0, 0);
-    if (!*baseAddress)
-    {
-        std::cerr << "MapViewOfFile() failed, name = " << fname
-                  << ", error = " << GetLastError() << std::endl;
-        exit(1);
-    }
-#endif
-}
-
-void unmap(void* baseAddress, uint64_t mapping) {
-
-#ifndef _WIN32
-    munmap(baseAddress, mapping);
-#else
-    UnmapViewOfFile(baseAddress);
-    CloseHandle((HANDLE)mapping);
-#endif
-}
-
-void error(Step* state, const char* data) {
+void error(Step* state, const char* data, std::ostream& log) {
 
     std::vector<std::string> stateDesc = {
         "HEADER", "TAG", "FEN_TAG", "BRACE_COMMENT", "VARIATION",
@@ -142,7 +191,7 @@ void error(Step* state, const char* data) {
         if (ToStep[i] == state)
         {
             std::string what = std::string(data, 50);
-            std::cerr << "Wrong " << stateDesc[i] << ": '"
+            log << "Wrong " << stateDesc[i] << ": '"
                       << what << "' " << std::endl;
         }
     //exit(0);
@@ -204,22 +253,34 @@ size_t write_poly_file(const Keys& kTable, const std::string& fname, bool full)
     return size;
 }
 
-size_t sort_by_frequency(Keys& kTable, size_t start, size_t end) {
+/// sort_by_frequency() sorts the entries of a position by move frequency. The
+/// entries of each move, its posting list, are sorted by 'learn', i.e. by game
+/// result and then by game offset, so that result counts and pages of game
+/// offsets can be read from a posting list without scanning it.
 
-    std::map<PMove, int> moves;
+size_t sort_by_frequency(Keys& kTable, size_t start, size_t end) {
 
-    for (size_t i = start; i < end; ++i)
-        moves[kTable[i].move]++;
+    if (end - start < 2)
+        return end;
 
     // Normalize weights to be stored in a uint16_t, so that 100% -> 0xFFFF
-    for (size_t i = start; i < end; ++i)
-        kTable[i].weight = moves[kTable[i].move] * 0xFFFF / (end - start);
+    if (end - start > 2)
+    {
+        std::map<PMove, int> moves;
+
+        for (size_t i = start; i < end; ++i)
+            moves[kTable[i].move]++;
+
+        for (size_t i = start; i < end; ++i)
+            kTable[i].weight = moves[kTable[i].move] * 0xFFFF / (end - start);
+    }
 
     std::sort(kTable.begin() + start, kTable.begin() + end,
               [](const PolyEntry& a, const PolyEntry& b) -> bool
     {
         return    a.weight > b.weight
-              || (a.weight == b.weight && a.move > b.move);
+              || (a.weight == b.weight && a.move > b.move)
+              || (a.weight == b.weight && a.move == b.move && a.learn < b.learn);
     });
 
     return end;
@@ -242,18 +303,85 @@ inline PMove to_polyglot(Move m) {
     return PMove(m & 0x3FFF);
 }
 
+/// A game archive, .cdb, keeps the games of a PGN as replayed by parse_game(),
+/// so that the book can be built again without parsing any SAN. After a magic,
+/// each game is stored as its offset in the PGN, 8 bytes, its result, 1 byte,
+/// with ArchiveFen set if a FEN follows, as a length byte then the FEN, then
+/// the number of plies, 2 bytes, and 1 byte per ply: the index of the move in
+/// the legal moves of the position, see ArchiveMoves, or ArchiveNull for a null
+/// move. Numbers are big-endian, as in a Polyglot book.
+
+const char ArchiveMagic[] = "CDBARCH1";
+const uint8_t ArchiveFen = 0x80, ArchiveNull = 0xFF;
+
+inline bool is_archive(const std::string& fName) {
+    return fName.size() > 4 && fName.compare(fName.size() - 4, 4, ".cdb") == 0;
+}
+
+// Archived moves are numbered as the legal moves among the pseudo-legal ones,
+// in generation order, so that decoding a move checks the legality of the
+// moves before it only. There are never more than 218 of them.
+struct ArchiveMoves {
+    explicit ArchiveMoves(const Position& p) : pos(p), moves(p),
+        pinned(p.pinned_pieces(p.side_to_move())), ksq(p.square<KING>(p.side_to_move())) {}
+
+    bool legal(Move m) const {
+        return !(pinned || from_sq(m) == ksq || type_of(m) == ENPASSANT) || pos.legal(m);
+    }
+
+    int index(Move m) const {
+        int idx = 0;
+        for (const ExtMove& em : moves)
+            if (em == m)
+                return idx;
+            else
+                idx += legal(em);
+        return -1;
+    }
+
+    Move at(int idx) const {
+        for (const ExtMove& em : moves)
+            if (legal(em) && !idx--)
+                return em;
+        return MOVE_NONE;
+    }
+
+    const Position& pos;
+    MoveList<PSEUDO_LEGAL> moves;
+    Bitboard pinned;
+    Square ksq;
+};
+
 template<bool DryRun = false>
 const char* parse_game(const char* moves, const char* end, Keys& kTable,
                        const char* fen, const char* fenEnd, size_t& fixed,
-                       uint64_t gameOfs, int result) {
+                       uint64_t gameOfs, int result, std::ostream& log, int maxPly = 0,
+                       std::string* archive = nullptr) {
 
     StateInfo states[1024], *st = states;
     Position pos = RootPos;
-    const char *cur = moves;
+    const char *cur = moves, *stop = end;
+    size_t plyCnt = 0;
+    uint8_t data[8];
 
     if (fenEnd != fen)
         pos.set(fen, false, st++);
 
+    if (archive)
+    {
+        archive->append((const char*)data, write(gameOfs, data) - data);
+        archive->push_back(char(result | (fenEnd != fen ? ArchiveFen : 0)));
+
+        if (fenEnd != fen)
+        {
+            archive->push_back(char(strlen(fen)));
+            archive->append(fen);
+        }
+
+        plyCnt = archive->size();
+        archive->append(2, 0); // Number of plies, set once known
+    }
+
     // Use Polyglot 'learn' parameter to store game result in the upper 2 bits,
     // and game offset in the PGN file. Note that the offset is 8 bytes aligned
     // and points to "somewhere" in the game. It is up to the look up tool to
@@ -264,7 +392,11 @@ const char* parse_game(const char* moves, const char* end, Keys& kTable,
     // upper 2 bits out of 32 bits store the result
     const uint32_t learn =  ((uint32_t(result) & 3) << 30)
                           | ((gameOfs >> 3) & 0x3FFFFFFF);
-    while (cur < end)
+
+    // Past the horizon, if any, the rest of the game is not even replayed,
+    // unless archived.
+    int ply = 0;
+    for ( ; cur < end && (!maxPly || ply < maxPly || archive); ++ply)
     {
         Move move = pos.san_to_move(cur, end, fixed);
         if (move == MOVE_NONE)
@@ -272,25 +404,38 @@ const char* parse_game(const char* moves, const char* end, Keys& kTable,
             if (!DryRun)
             {
                 const char* sep = pos.side_to_move() == WHITE ? "" : "..";
-                std::cerr << "\nWrong move notation: " << sep << cur
+                log << "\nWrong move notation: " << sep << cur
                           << "\n" << pos << std::endl;
 
             }
-            return cur;
+            stop = cur;
+            break;
         }
         else if (move == MOVE_NULL)
+        {
+            if (archive)
+                archive->push_back(char(ArchiveNull));
+
             pos.do_null_move(*st++);
+        }
         else
         {
-            if (!DryRun)
+            if (!DryRun && (!maxPly || ply < maxPly))
                 kTable.push_back({pos.key(), to_polyglot(move), 1, learn});
 
+            if (archive)
+                archive->push_back(char(ArchiveMoves(pos).index(move)));
+
             pos.do_move(move, *st++, pos.gives_check(move));
         }
 
         while (*cur++) {} // Go to next move
     }
-    return end;
+
+    if (archive)
+        write(uint16_t(ply), (uint8_t*)&(*archive)[plyCnt]);
+
+    return stop;
 }
 
 int get_result(const char* data) {
@@ -316,7 +461,9 @@ int get_result(const char* data) {
     return 3;
 }
 
-void parse_pgn(void* baseAddress, uint64_t size, Stats& stats, Keys& kTable) {
+void parse_pgn(void* baseAddress, uint64_t size, Stats& stats, Keys& kTable,
+               Progress& progress, uint64_t start = 0, int maxPly = 0,
+               std::string* archive = nullptr) {
 
     Step* stateStack[16];
     Step**stateSp = stateStack;
@@ -324,10 +471,10 @@ void parse_pgn(void* baseAddress, uint64_t size, Stats& stats, Keys& kTable) {
     char moves[1024 * 8], *curMove = moves;
     char* end = curMove;
     size_t moveCnt = 0, gameCnt = 0, fixed = 0;
-    uint64_t gameOfs = 0;
+    uint64_t gameOfs = start, gamesBase = progress.games;
     int result = 3;
-    char* data = (char*)baseAddress;
-    char* eof = data + size;
+    char* data = (char*)baseAddress + start;
+    char* eof = (char*)baseAddress + size;
     int stm = WHITE;
     Step* state = ToStep[HEADER];
 
@@ -338,7 +485,7 @@ void parse_pgn(void* baseAddress, uint64_t size, Stats& stats, Keys& kTable) {
         switch (state[tk])
         {
         case FAIL:
-            error(state, data);
+            error(state, data, *progress.log);
             break;
 
         case CONTINUE:
@@ -449,10 +596,11 @@ void parse_pgn(void* baseAddress, uint64_t size, Stats& stats, Keys& kTable) {
                 state = ToStep[RESULT];
                 break;
             }
-            parse_game(moves, end, kTable, fen, fenEnd, fixed, gameOfs, result);
+            parse_game(moves, end, kTable, fen, fenEnd, fixed, gameOfs, result, *progress.log, maxPly, archive);
             gameCnt++;
             result = 3;
             gameOfs = (data - (char*)baseAddress) + 1; // Beginning of next game
+            progress.bytes = gameOfs, progress.games = gamesBase + gameCnt;
             end = curMove = moves;
             fenEnd = fen;
             state = ToStep[HEADER];
@@ -467,10 +615,11 @@ void parse_pgn(void* baseAddress, uint64_t size, Stats& stats, Keys& kTable) {
              /* Fall through */
 
         case MISSING_RESULT: // Missing result, next game already started
-            parse_game(moves, end, kTable, fen, fenEnd, fixed, gameOfs, result);
+            parse_game(moves, end, kTable, fen, fenEnd, fixed, gameOfs, result, *progress.log, maxPly, archive);
             gameCnt++;
             result = 3;
             gameOfs = (data - (char*)baseAddress); // Beginning of next game
+            progress.bytes = gameOfs, progress.games = gamesBase + gameCnt;
             end = curMove = moves;
             fenEnd = fen;
             state = ToStep[HEADER];
@@ -486,410 +635,3353 @@ void parse_pgn(void* baseAddress, uint64_t size, Stats& stats, Keys& kTable) {
         }
     }
 
+    stats.resume = gameOfs;
+    stats.clean = true;
+
     // Force accounting of last game if still pending. Many reason for this to
     // trigger: no newline at EOF, missing result, missing closing brace, etc.
     if (state != ToStep[HEADER] && state != ToStep[SKIP_GAME] && end - moves)
     {
-        parse_game(moves, end, kTable, fen, fenEnd, fixed, gameOfs, result);
+        parse_game(moves, end, kTable, fen, fenEnd, fixed, gameOfs, result, *progress.log, maxPly, archive);
         gameCnt++;
+        stats.clean = false;
     }
 
     stats.games = gameCnt;
     stats.moves = moveCnt;
     stats.fixed = fixed;
+    progress.bytes = size, progress.games = gamesBase + gameCnt;
 }
 
-} // namespace
+/// parse_archive() replays the games of an archive written along a parse_pgn()
+/// into the same entries, without any SAN to parse. Returns false if the file
+/// is not an archive or is corrupted.
 
-const char* play_game(const Position& pos, Move move, const char* cur, const char* end) {
+bool parse_archive(void* baseAddress, uint64_t size, Stats& stats, Keys& kTable,
+                   Progress& progress, int maxPly = 0) {
 
-    size_t fixed;
-    Keys k;
-    StateInfo st;
-    Position p = pos;
-    p.do_move(move, st, pos.gives_check(move));
-    while (*cur++) {} // Move to next move in game
-    return cur < end ? parse_game<true>(cur, end, k, p.fen().c_str(),
-                                        nullptr, fixed, 0, 3) : cur;
-}
+    StateInfo states[1024];
+    const uint8_t* data = (const uint8_t*)baseAddress;
+    const uint8_t* eof = data + size;
 
-namespace Parser {
+    auto read = [&](int bytes) {
+        uint64_t n = 0;
+        while (bytes--)
+            n = (n << 8) | *data++;
+        return n;
+    };
 
+    if (size < 8 || memcmp(data, ArchiveMagic, 8))
+        return false;
 
-void init() {
+    data += 8;
+    stats = Stats();
 
-    static StateInfo st;
-    const char* startFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
-    RootPos.set(startFEN, false, &st);
+    while (data < eof)
+    {
+        StateInfo* st = states;
+        Position pos = RootPos;
 
-    ToToken['\n'] = ToToken['\r'] = ToToken[' '] = ToToken['\t'] = T_SPACES;
-    ToToken['/'] = ToToken['*'] = T_RESULT;
-    ToToken['-'] = T_MINUS;
-    ToToken['.'] = T_DOT;
-    ToToken['"'] = T_QUOTES;
-    ToToken['$'] = T_DOLLAR;
-    ToToken['['] = T_LEFT_BRACKET;
-    ToToken[']'] = T_RIGHT_BRACKET;
-    ToToken['{'] = T_LEFT_BRACE;
-    ToToken['}'] = T_RIGHT_BRACE;
-    ToToken['('] = T_LEFT_PARENTHESIS;
-    ToToken[')'] = T_RIGHT_PARENTHESIS;
-    ToToken['E'] = T_EVENT;
-    ToToken['0'] = T_ZERO;
-    ToToken['1'] = ToToken['2'] = ToToken['3'] =
-    ToToken['4'] = ToToken['5'] = ToToken['6'] = ToToken['7'] =
-    ToToken['8'] = ToToken['9'] = T_DIGIT;
-    ToToken['a'] = ToToken['b'] = ToToken['c'] = ToToken['d'] =
-    ToToken['e'] = ToToken['f'] = ToToken['g'] = ToToken['h'] =
-    ToToken['N'] = ToToken['B'] = ToToken['R'] = ToToken['Q'] =
-    ToToken['K'] = ToToken['O'] = ToToken['o'] = T_MOVE_HEAD;
+        if (eof - data < 9)
+            return false;
 
-    // Trailing move notations are ignored because SAN detector
-    // does not need them and in some malformed PGN they appear
-    // one blank apart from the corresponding move.
-    ToToken['!'] = ToToken['?'] = ToToken['+'] = ToToken['#'] = T_SPACES;
+        uint64_t gameOfs = read(8);
+        uint8_t result = uint8_t(read(1));
 
-    // STATE = HEADER
-    //
-    // Between tags, before game starts. Accept anything
-    for (int i = 0; i < TOKEN_NB; i++)
-        ToStep[HEADER][i] = CONTINUE;
+        if (result & ArchiveFen)
+        {
+            size_t len = *data++;
+            if (size_t(eof - data) < len)
+                return false;
 
-    ToStep[HEADER][T_LEFT_BRACKET] = OPEN_TAG;
-    ToStep[HEADER][T_LEFT_BRACE  ] = OPEN_BRACE_COMMENT;
-    ToStep[HEADER][T_DIGIT       ] = START_MOVE_NUMBER;
-    ToStep[HEADER][T_ZERO        ] = START_RESULT;
-    ToStep[HEADER][T_RESULT      ] = START_RESULT;
+            pos.set(std::string((const char*)data, len), false, st++);
+            data += len;
+        }
 
-    // STATE = TAG
-    //
-    // Between brackets in header section, generic tag
-    for (int i = 0; i < TOKEN_NB; i++)
-        ToStep[TAG][i] = CONTINUE;
+        if (eof - data < 2)
+            return false;
 
-    ToStep[TAG][T_RIGHT_BRACKET] = POP_STATE;
+        size_t plies = size_t(read(2));
+        if (size_t(eof - data) < plies || plies >= 1024)
+            return false;
 
-    // STATE = FEN_TAG
-    //
-    // Special tag to set a position from a FEN string
-    for (int i = 0; i < TOKEN_NB; i++)
-        ToStep[FEN_TAG][i] = READ_FEN;
+        const uint32_t learn =  ((uint32_t(result) & 3) << 30)
+                              | ((gameOfs >> 3) & 0x3FFFFFFF);
 
-    ToStep[FEN_TAG][T_QUOTES] = CLOSE_FEN_TAG;
+        for (size_t ply = 0; ply < plies; ++ply)
+        {
+            uint8_t idx = *data++;
 
-    // STATE = BRACE_COMMENT
-    //
-    // Comment in braces, can appear almost everywhere. Note that brace comments
-    // do not nest according to PGN standard.
-    for (int i = 0; i < TOKEN_NB; i++)
-        ToStep[BRACE_COMMENT][i] = CONTINUE;
+            if (idx == ArchiveNull)
+            {
+                pos.do_null_move(*st++);
+                continue;
+            }
 
-    ToStep[BRACE_COMMENT][T_RIGHT_BRACE ] = POP_STATE;
-    ToStep[BRACE_COMMENT][T_LEFT_BRACKET] = TAG_IN_BRACE; // Missed closing brace
+            Move move = ArchiveMoves(pos).at(idx);
+            if (move == MOVE_NONE)
+                return false;
 
-    // STATE = VARIATION
-    //
-    // For the moment variations are ignored
-    for (int i = 0; i < TOKEN_NB; i++)
-        ToStep[VARIATION][i] = CONTINUE;
+            if (!maxPly || int(ply) < maxPly)
+                kTable.push_back({pos.key(), to_polyglot(move), 1, learn});
 
-    ToStep[VARIATION][T_RIGHT_PARENTHESIS] = POP_STATE;
-    ToStep[VARIATION][T_LEFT_PARENTHESIS ] = OPEN_VARIATION; // Nested
-    ToStep[VARIATION][T_LEFT_BRACE       ] = OPEN_BRACE_COMMENT;
+            pos.do_move(move, *st++, pos.gives_check(move));
+        }
 
-    // STATE = NUMERIC_ANNOTATION_GLYPH
-    //
-    // Just read a single number
-    for (int i = 0; i < TOKEN_NB; i++)
-        ToStep[NUMERIC_ANNOTATION_GLYPH][i] = POP_STATE;
+        stats.games++;
+        stats.moves += plies;
+        progress.bytes = data - (const uint8_t*)baseAddress, progress.games = stats.games;
+    }
 
-    ToStep[NUMERIC_ANNOTATION_GLYPH][T_ZERO ] = CONTINUE;
-    ToStep[NUMERIC_ANNOTATION_GLYPH][T_DIGIT] = CONTINUE;
+    return true;
+}
 
-    // STATE = NEXT_MOVE
-    //
-    // Check for the beginning of the next move number
-    for (int i = 0; i < TOKEN_NB; i++)
-        ToStep[NEXT_MOVE][i] = CONTINUE;
+/// A move list file, .uci, has a game per line, as the moves in coordinate
+/// notation, e2e4 e7e5 ..., then the result, if any. A line may start with
+/// "fen <fen> moves" for a game not starting from the start position.
 
-    ToStep[NEXT_MOVE][T_LEFT_PARENTHESIS] = OPEN_VARIATION;
-    ToStep[NEXT_MOVE][T_LEFT_BRACE      ] = OPEN_BRACE_COMMENT;
-    ToStep[NEXT_MOVE][T_LEFT_BRACKET    ] = MISSING_RESULT;
-    ToStep[NEXT_MOVE][T_DOLLAR          ] = START_NAG;
-    ToStep[NEXT_MOVE][T_RESULT          ] = START_RESULT;
-    ToStep[NEXT_MOVE][T_ZERO            ] = START_RESULT;
-    ToStep[NEXT_MOVE][T_DOT             ] = FAIL;
-    ToStep[NEXT_MOVE][T_MOVE_HEAD       ] = FAIL;
-    ToStep[NEXT_MOVE][T_MINUS           ] = FAIL;
-    ToStep[NEXT_MOVE][T_DIGIT           ] = START_MOVE_NUMBER;
+inline bool is_move_list(const std::string& fName) {
+    return fName.size() > 4 && fName.compare(fName.size() - 4, 4, ".uci") == 0;
+}
 
-    // STATE = MOVE_NUMBER
-    //
-    // Continue until a dot is found, to tolerate missing dots,
-    // stop at first space, then start NEXT_SAN that will handle
-    // head trailing spaces. We can alias with a result like 1-0 or 1/2-1/2
-    ToStep[MOVE_NUMBER][T_ZERO  ] = CONTINUE;
-    ToStep[MOVE_NUMBER][T_DIGIT ] = CONTINUE;
-    ToStep[MOVE_NUMBER][T_RESULT] = START_RESULT;
-    ToStep[MOVE_NUMBER][T_MINUS ] = START_RESULT;
-    ToStep[MOVE_NUMBER][T_SPACES] = START_NEXT_SAN;
-    ToStep[MOVE_NUMBER][T_DOT   ] = START_NEXT_SAN;
+/// parse_lan() indexes the games of a move list file as parse_pgn() does the
+/// games of a PGN, the offset of a game being the one of its line. A game is
+/// indexed up to its first illegal move, if any, that is counted in 'fixed'.
 
-    // STATE = NEXT_SAN
-    //
-    // Check for the beginning of the next move SAN
-    for (int i = 0; i < TOKEN_NB; i++)
-        ToStep[NEXT_SAN][i] = CONTINUE;
+void parse_lan(void* baseAddress, uint64_t size, Stats& stats, Keys& kTable,
+               Progress& progress, int maxPly = 0) {
 
-    ToStep[NEXT_SAN][T_LEFT_PARENTHESIS] = OPEN_VARIATION;
-    ToStep[NEXT_SAN][T_LEFT_BRACE      ] = OPEN_BRACE_COMMENT;
-    ToStep[NEXT_SAN][T_LEFT_BRACKET    ] = MISSING_RESULT;
-    ToStep[NEXT_SAN][T_DOLLAR          ] = START_NAG;
-    ToStep[NEXT_SAN][T_RESULT          ] = START_RESULT;
-    ToStep[NEXT_SAN][T_ZERO            ] = CASTLE_OR_RESULT;  // 0-0 or 0-1
-    ToStep[NEXT_SAN][T_DOT             ] = CONTINUE;          // Like 4... exd5
-    ToStep[NEXT_SAN][T_DIGIT           ] = START_MOVE_NUMBER; // Same as above
-    ToStep[NEXT_SAN][T_MOVE_HEAD       ] = START_READ_SAN;
-    ToStep[NEXT_SAN][T_MINUS           ] = START_READ_SAN;    // Null move "--"
+    const char* base = (const char*)baseAddress;
+    const char* eof = base + size;
+    StateInfo states[1024];
 
-    // STATE = READ_SAN
-    //
-    // Just read a single move SAN until a space is reached
-    for (int i = 0; i < TOKEN_NB; i++)
-        ToStep[READ_SAN][i] = READ_MOVE_CHAR;
+    stats = Stats();
 
-    ToStep[READ_SAN][T_SPACES    ] = END_MOVE;
-    ToStep[READ_SAN][T_LEFT_BRACE] = OPEN_BRACE_COMMENT;
+    for (const char *data = base, *eol; data < eof; data = eol + 1)
+    {
+        eol = std::find(data, eof, '\n');
 
-    // STATE = RESULT
-    //
-    // Ignore anything until a space is reached
-    for (int i = 0; i < TOKEN_NB; i++)
-        ToStep[RESULT][i] = CONTINUE;
+        const char* end = eol;
+        while (end > data && isspace(*(const uint8_t*)(end - 1)))
+            --end;
 
-    ToStep[RESULT][T_SPACES] = END_GAME;
+        if (end == data) // Empty line
+            continue;
 
-    // STATE = SKIP_GAME
-    //
-    // Ignore anything until start of next game
-    for (int i = 0; i < TOKEN_NB; i++)
-        ToStep[SKIP_GAME][i] = CONTINUE;
+        // The result is the last token, if any
+        const char* last = end;
+        while (last > data && !isspace(*(const uint8_t*)(last - 1)))
+            --last;
 
-    ToStep[SKIP_GAME][T_EVENT] = GAME_START;
-}
+        std::string token(last, end);
+        int result =  token == "1-0" ? 0 : token == "0-1" ? 1
+                    : token == "1/2-1/2" ? 2 : 3;
 
-void make_book(std::istringstream& is) {
+        if (result != 3 || token == "*")
+            end = last;
 
-    Keys kTable;
-    Stats stats;
-    uint64_t mapping, size;
-    void* baseAddress;
-    std::string bookName, opt;
+        StateInfo* st = states;
+        Position pos = RootPos;
+        const char* cur = data;
 
-    is >> bookName;
+        if (!strncmp(cur, "fen ", 4))
+        {
+            const char* moves = std::search(cur, end, " moves", " moves" + 6);
+            pos.set(std::string(cur + 4, moves), false, st++);
+            cur = std::min(moves + 6, end);
+        }
 
-    if (bookName.empty())
-    {
-        std::cerr << "Missing PGN file name..." << std::endl;
-        exit(0);
-    }
+        const uint32_t learn =  ((uint32_t(result) & 3) << 30)
+                              | (((data - base) >> 3) & 0x3FFFFFFF);
 
-    is >> opt;
-    bool full = opt == "full";
+        for (int ply = 0; cur < end && (!maxPly || ply < maxPly) && st < states + 1023; ++ply)
+        {
+            while (cur < end && isspace(*(const uint8_t*)cur))
+                ++cur;
 
-    map(bookName.c_str(), &baseAddress, &mapping, &size);
+            const char* next = cur;
+            while (next < end && !isspace(*(const uint8_t*)next))
+                ++next;
 
-    // Reserve enough capacity according to file size. This is a very crude
-    // estimation, mainly we assume key index to be of 2 times the size of
-    // the pgn file.
-    kTable.reserve(2 * size / sizeof(PolyEntry));
+            if (next == cur)
+                break;
 
-    std::cerr << "\nProcessing...";
+            Move move = pos.lan_to_move(cur, next - cur);
+            if (move == MOVE_NONE)
+            {
+                *progress.log << "\nWrong move: " << std::string(cur, next)
+                              << "\n" << pos << std::endl;
+                stats.fixed++;
+                break;
+            }
 
-    TimePoint elapsed = now();
+            kTable.push_back({pos.key(), to_polyglot(move), 1, learn});
+            pos.do_move(move, *st++, pos.gives_check(move));
+            stats.moves++;
+            cur = next;
+        }
 
-    parse_pgn(baseAddress, size, stats, kTable);
+        stats.games++;
+        progress.bytes = eol - base, progress.games = stats.games;
+    }
+
+    stats.resume = size;
+    stats.clean = true;
+}
+
+/// game_start() returns the offset where the game starting first at or after
+/// 'ofs' begins, as parse_pgn() sees it: past the end of line of the result of
+/// the previous game, if any, else at its first tag. A game starts with a tag,
+/// '[Name "', at the beginning of a line that does not follow another tag.
+/// Returns 'size' when no game starts after 'ofs'.
+
+uint64_t game_start(const char* data, uint64_t size, uint64_t ofs) {
+
+    if (!ofs || ofs >= size)
+        return std::min(ofs, size);
+
+    for (const char* tag = data + ofs - 1; ; ++tag)
+    {
+        tag = std::search(tag, data + size, "\n[", "\n[" + 2);
+
+        if (tag == data + size)
+            return size;
+
+        const char* name = tag + 2;
+        while (name < data + size && (isalnum(*(const uint8_t*)name) || *name == '_'))
+            ++name;
+
+        if (name == tag + 2 || name + 1 >= data + size || name[0] != ' ' || name[1] != '"')
+            continue;
+
+        const char* last = tag;
+        while (last > data && isspace(*(const uint8_t*)last))
+            --last;
+
+        if (*last == ']')
+            continue;
+
+        if (!strchr("012*", *last))
+            return tag - data + 1;
+
+        return std::find(last, tag, '\n') - data + 1;
+    }
+}
+
+/// ns_per_probe() times repeated calls to the given probe over all the keys,
+/// for at least 200 msec, and returns the average time of a call in nsec.
+
+template<typename Probe>
+double ns_per_probe(const std::vector<Key>& keys, Probe probe) {
+
+    uint64_t calls = 0, sink = 0;
+    TimePoint elapsed, start = now();
+
+    do {
+        for (Key k : keys)
+            sink += probe(k);
+
+        calls += keys.size();
+
+    } while ((elapsed = now() - start) < 200 && !keys.empty());
+
+    volatile uint64_t dummy = sink; // Avoid the calls being optimized away
+    (void)dummy;
+    return calls ? 1e6 * elapsed / calls : 0;
+}
+
+/// read_limits() parses the "limit" and "skip" options of a query. Returns
+/// false if the token is not one of them. A limit below 1 is left to the
+/// caller to reject.
+
+bool read_limits(std::istringstream& is, const std::string& token, size_t& limit, size_t& skip) {
+
+    if (token == "limit")
+    {
+        std::string value;
+        is >> value;
+        std::stringstream to_size_t(value);
+        limit = 0;
+        to_size_t >> limit;
+    }
+    else if (token == "skip")
+    {
+        std::string value;
+        is >> value;
+        // There is no need to validate the bounds of skip as once can be
+        // skipping a lot of games in a large DB.
+        std::stringstream to_size_t(value);
+        to_size_t >> skip;
+    }
+    else
+        return false;
+
+    return true;
+}
+
+/// count_results() adds up the results of all the games that reached the
+/// position whose first entry is at index idx, whatever move was played next.
+
+void count_results(const MappedBook& book, size_t idx, uint64_t results[4]) {
+
+    for (Key key = book.key(idx); idx < book.size() && book.key(idx) == key; ++idx)
+        results[(book[idx].learn >> 30) & 3]++;
+}
+
+/// make_cursor() and read_cursor() convert to and from an opaque token the
+/// position of the next page of a query: the position key and the number of
+/// games to skip in each posting list. A check word catches mangled tokens.
+
+std::string make_cursor(Key key, size_t skip) {
+
+    std::stringstream ss;
+    ss << std::hex << std::setfill('0')
+       << std::setw(16) << key
+       << std::setw(16) << uint64_t(skip)
+       << std::setw(4)  << (mix(key ^ skip, 0) & 0xFFFF);
+    return ss.str();
+}
+
+bool read_cursor(const std::string& token, Key& key, size_t& skip) {
+
+    if (   token.size() != 36
+        || token.find_first_not_of("0123456789abcdef") != std::string::npos)
+        return false;
+
+    key  = std::strtoull(token.substr(0, 16).c_str(), nullptr, 16);
+    skip = std::strtoull(token.substr(16, 16).c_str(), nullptr, 16);
+    return std::strtoull(token.substr(32).c_str(), nullptr, 16) == (mix(key ^ skip, 0) & 0xFFFF);
+}
+
+/// book_list() expands the book argument of a query over several books, a
+/// comma separated list of books and manifests. A manifest is a text file
+/// listing one book per line, relative to the manifest directory. Returns an
+/// error message, empty on success.
+
+std::string book_list(const std::string& arg, std::vector<std::string>& books) {
+
+    std::istringstream ss(arg);
+    std::string name, line;
+
+    while (std::getline(ss, name, ','))
+    {
+        if (name.size() >= 4 && name.compare(name.size() - 4, 4, ".bin") == 0)
+        {
+            books.push_back(name);
+            continue;
+        }
+
+        std::ifstream manifest(name);
+        if (!manifest.is_open())
+            return "Could not open manifest " + name;
+
+        size_t slash = name.find_last_of("/\\");
+        std::string dir = slash == std::string::npos ? "" : name.substr(0, slash + 1);
+
+        while (std::getline(manifest, line))
+        {
+            line = line.substr(0, line.find_last_not_of(" \t\r") + 1);
+            if (!line.empty() && line[0] != '#')
+                books.push_back(line[0] == '/' ? line : dir + line);
+        }
+    }
+
+    return books.empty() ? "Empty book list " + arg : "";
+}
+
+/// parallel_for() calls f(i) for each i in [0, n), on the calling thread and
+/// on a pool shared by all the queries, and returns when all calls are done.
+
+template<typename F>
+void parallel_for(size_t n, F f) {
+
+    static ThreadPool pool(std::thread::hardware_concurrency());
+
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t pending = n ? n - 1 : 0;
+
+    for (size_t i = 1; i < n; ++i)
+        pool.submit([&, i]{
+            f(i);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!--pending)
+                done.notify_one();
+        });
+
+    if (n)
+        f(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&]{ return !pending; });
+}
+
+/// sources_name() returns the name of the sources sidecar of a merged book,
+/// that tells where the games of the book come from. Each line is a source:
+/// the first game offset of the source in the book, its size in bytes and its
+/// PGN file, as given when merging.
+
+std::string sources_name(const std::string& bookName) {
+
+    size_t lastdot = bookName.find_last_of(".");
+    return bookName.substr(0, lastdot) + ".src";
+}
+
+struct Source {
+    uint64_t base, size;
+    std::string pgn;
+};
+
+bool read_sources(const std::string& fName, std::vector<Source>& sources) {
+
+    std::ifstream ifs(fName);
+    std::string line;
+
+    while (std::getline(ifs, line))
+    {
+        std::istringstream ss(line);
+        Source s;
+
+        if (ss >> s.base >> s.size >> std::ws && std::getline(ss, s.pgn))
+            sources.push_back(s);
+    }
+
+    return !sources.empty();
+}
+
+/// position_json() formats the probing info of a position in JSON format. An
+/// empty FEN, as when querying by key, is omitted. Additional fields, already
+/// formatted, can be appended after the moves.
+
+std::string position_json(const std::string& fen, Key key,
+                          const std::vector<std::string>& json_moves,
+                          const std::string& extra = "") {
+
+    std::string tab = "\n    ";
+    std::string indent8 = "        ";
+    std::stringstream json;
+    json << "{";
+
+    if (!fen.empty())
+        json << tab << "\"fen\": \"" << fen << "\",";
+
+    json << tab << "\"key\": " << key << ","
+         << tab << "\"moves\": [";
+
+    std::string comma;
+    for (auto& m : json_moves)
+    {
+        json << comma << tab << "   {" << tab << indent8 << m << tab << "   }";
+        comma = ",";
+    }
+
+    json << tab << "]" << extra << "\n}";
+    return json.str();
+}
+
+/// merge_books() writes the entries of the given sorted books as if they were
+/// built out of all their games at once, in a single k-way sweep, one position
+/// at a time: weights are recomputed as sort_by_frequency() does and posting
+/// lists of each move are merged by result, then by game offset. Game offsets
+/// of each book are moved by its base, in units of 8 bytes. Moves of less than
+/// 'minGames' games over all the books are dropped, as prune_keys() does.
+/// Returns the number of unique positions.
+
+uint64_t merge_books(const std::vector<const MappedBook*>& books,
+                     const std::vector<uint32_t>& bases, bool full, std::ostream& ofs,
+                     size_t minGames = 0) {
+
+    // A run is the posting list of a move of the current position in a book
+    struct Run {
+        size_t book;
+        PMove move;
+        size_t idx, end;
+    };
+
+    std::vector<size_t> next(books.size());
+    std::vector<Run> runs;
+    std::vector<Run*> parts;
+    std::vector<std::pair<uint16_t, PMove>> moves; // Weight, move
+    uint8_t data[SizeOfPolyEntry];
+    uint64_t uniqueKeys = 0;
+
+    auto learn = [&](const Run& r) {
+        uint32_t l = (*books[r.book])[r.idx].learn;
+        return (l & 0xC0000000) | ((l & 0x3FFFFFFF) + bases[r.book]);
+    };
+
+    while (true)
+    {
+        bool found = false;
+        Key key = 0;
+
+        for (size_t i = 0; i < books.size(); ++i)
+            if (next[i] < books[i]->size() && (!found || books[i]->key(next[i]) < key))
+            {
+                key = books[i]->key(next[i]);
+                found = true;
+            }
+
+        if (!found)
+            break;
+
+        runs.clear();
+        moves.clear();
+
+        for (size_t i = 0; i < books.size(); ++i)
+        {
+            const MappedBook& book = *books[i];
+            size_t& idx = next[i];
+
+            while (idx < book.size() && book.key(idx) == key)
+            {
+                Run r = { i, book[idx].move, idx, idx };
+                while (r.end < book.size() && book.key(r.end) == key && book[r.end].move == r.move)
+                    r.end++;
+
+                runs.push_back(r);
+                idx = r.end;
+            }
+        }
+
+        // Weights and move order as sort_by_frequency() on all the games
+        size_t total = 0;
+        for (const Run& r : runs)
+            total += r.end - r.idx;
+
+        for (const Run& r : runs)
+            if (std::find_if(moves.begin(), moves.end(), [&](const std::pair<uint16_t, PMove>& m) {
+                    return m.second == r.move; }) == moves.end())
+            {
+                size_t cnt = 0;
+                for (const Run& x : runs)
+                    cnt += x.move == r.move ? x.end - x.idx : 0;
+
+                if (cnt >= minGames)
+                    moves.push_back({ uint16_t(total > 2 ? cnt * 0xFFFF / total : 1), r.move });
+            }
+
+        std::sort(moves.rbegin(), moves.rend());
+
+        for (const auto& m : moves)
+        {
+            parts.clear();
+            for (Run& r : runs)
+                if (r.move == m.second)
+                    parts.push_back(&r);
+
+            // Posting lists are merged by 'learn', i.e. by result then game offset
+            while (true)
+            {
+                Run* best = nullptr;
+                for (Run* r : parts)
+                    if (r->idx < r->end && (!best || learn(*r) < learn(*best)))
+                        best = r;
+
+                if (!best)
+                    break;
+
+                PolyEntry e = { key, m.second, m.first, learn(*best) };
+                write(e, data);
+                ofs.write((const char*)data, SizeOfPolyEntry);
+
+                if (full)
+                    best->idx++;
+
+                else // Only the first entry of a move, as write_poly_file()
+                    for (Run* r : parts)
+                        r->idx = r->end;
+            }
+        }
+
+        uniqueKeys += !moves.empty();
+    }
+
+    return uniqueKeys;
+}
+
+// A live index serves the games of a growing PGN file as soon as they are
+// ingested, without rebuilding its book. New games go into a sorted in-memory
+// delta, written out as an immutable sorted run when it gets big. Runs are
+// merged into a single one in the background when they get many. Queries see
+// an immutable snapshot of the book, the runs and the delta, that is replaced
+// as a whole on every change, so they never wait for an ingest.
+struct LiveSnapshot {
+    uint64_t id;
+    std::shared_ptr<const MappedBook> book;
+    std::vector<std::shared_ptr<const MappedBook>> runs;
+    std::vector<std::string> runNames;
+    std::shared_ptr<const Keys> delta;
+};
+
+struct LiveIndex {
+   ~LiveIndex();
+
+    std::mutex mutex; // Serializes changes of the snapshot
+    std::string stem;
+    uint64_t ingested; // PGN bytes indexed so far
+    size_t flushEntries;
+    bool compacting;
+    std::shared_ptr<const LiveSnapshot> snapshot;
+    std::thread compactor;
+};
+
+const size_t MaxRuns = 4;
+
+std::mutex LiveMutex; // Guards the map and the snapshot pointers
+std::map<std::string, std::shared_ptr<LiveIndex>> LiveIndexes; // By book name
+std::atomic<uint64_t> LiveSnapshots(0), LiveRuns(0);
+
+// Runs are numbered across indexes, so that a dropped index never removes the
+// runs of the one that replaced it
+std::string run_name(const std::string& stem) {
+    return stem + ".run" + std::to_string(++LiveRuns) + ".bin";
+}
+
+LiveIndex::~LiveIndex() {
+
+    if (compactor.joinable())
+        compactor.join();
+
+    for (const std::string& name : snapshot->runNames)
+        std::remove(name.c_str());
+}
+
+// A rebuilt book indexes all the games of the live index, that is dropped
+void drop_live(const std::string& bookName) {
+
+    std::shared_ptr<LiveIndex> index; // Destroyed out of the lock, as it may wait
+    {
+        std::lock_guard<std::mutex> lock(LiveMutex);
+
+        auto it = LiveIndexes.find(bookName);
+        if (it != LiveIndexes.end())
+        {
+            index = it->second;
+            LiveIndexes.erase(it);
+        }
+    }
+}
+
+// Delta entries are kept sorted as the entries of a run, written in full mode
+bool live_order(const PolyEntry& a, const PolyEntry& b) {
+    return    a.key < b.key
+          || (a.key == b.key && a.move < b.move)
+          || (a.key == b.key && a.move == b.move && a.learn < b.learn);
+}
+
+std::shared_ptr<const LiveSnapshot> live_snapshot(const std::string& bookName) {
+
+    std::lock_guard<std::mutex> lock(LiveMutex);
+
+    auto it = LiveIndexes.find(bookName);
+    return it != LiveIndexes.end() ? it->second->snapshot : nullptr;
+}
+
+// Called with index.mutex held
+void publish(LiveIndex& index, LiveSnapshot* snap) {
+
+    snap->id = ++LiveSnapshots;
+
+    std::lock_guard<std::mutex> lock(LiveMutex);
+    index.snapshot = std::shared_ptr<const LiveSnapshot>(snap);
+}
+
+/// compact() merges the runs of a snapshot into a single one, then replaces
+/// them with it in the current snapshot, that may have got more runs since.
+/// Runs on the compactor thread of the index.
+
+void compact(LiveIndex& index, std::shared_ptr<const LiveSnapshot> snap) {
+
+    std::string runName = run_name(index.stem);
+    std::vector<const MappedBook*> runs;
+    for (const auto& r : snap->runs)
+        runs.push_back(r.get());
+
+    std::ofstream ofs(runName, std::ofstream::out | std::ofstream::binary);
+    merge_books(runs, std::vector<uint32_t>(runs.size(), 0), true, ofs);
+    ofs.close();
+
+    std::shared_ptr<MappedBook> merged = std::make_shared<MappedBook>();
+    std::lock_guard<std::mutex> lock(index.mutex);
+
+    // The runs are kept as they are, to be compacted again later
+    if (!merged->open(runName))
+    {
+        std::remove(runName.c_str());
+        index.compacting = false;
+        return;
+    }
+
+    const LiveSnapshot& cur = *index.snapshot;
+    LiveSnapshot* next = new LiveSnapshot{ 0, cur.book, { merged }, { runName }, cur.delta };
+
+    // Runs are only ever appended, the compacted ones come first
+    next->runs.insert(next->runs.end(), cur.runs.begin() + runs.size(), cur.runs.end());
+    next->runNames.insert(next->runNames.end(), cur.runNames.begin() + runs.size(), cur.runNames.end());
+    publish(index, next);
+
+    // Queries still running keep the old runs mapped. On Windows they cannot be
+    // removed then, and are left behind.
+    for (size_t i = 0; i < runs.size(); ++i)
+        std::remove(snap->runNames[i].c_str());
+
+    index.compacting = false;
+}
+
+/// prune_keys() drops out of sorted entries the moves played in less than
+/// 'minGames' games. Weights of the moves left are kept as they are, i.e. as
+/// shares of all the games of the position. Returns the number of unique keys
+/// left.
+
+size_t prune_keys(Keys& kTable, size_t minGames) {
+
+    size_t uniqueKeys = 0, out = 0;
+
+    for (size_t idx = 0, end; idx < kTable.size(); idx = end)
+    {
+        end = idx + 1;
+        while (   end < kTable.size() && kTable[end].key == kTable[idx].key
+               && kTable[end].move == kTable[idx].move)
+            end++;
+
+        if (end - idx < minGames)
+            continue;
+
+        if (!out || kTable[out - 1].key != kTable[idx].key)
+            uniqueKeys++;
+
+        out = std::copy(kTable.begin() + idx, kTable.begin() + end, kTable.begin() + out) - kTable.begin();
+    }
+
+    kTable.resize(out);
+    return uniqueKeys;
+}
+
+/// sort_keys() sorts the entries of a parsed PGN by key, then the entries of
+/// each key by sort_by_frequency(), then drops the moves played in less than
+/// 'minGames' games, if any. Returns the number of unique keys.
+
+size_t sort_keys(Keys& kTable, size_t minGames = 0) {
+
+    std::sort(kTable.begin(), kTable.end());
+
+    size_t uniqueKeys = 0, last = 0;
+    for (size_t idx = 1; idx <= kTable.size(); ++idx)
+        if (idx == kTable.size() || kTable[idx].key != kTable[idx - 1].key)
+        {
+            idx = sort_by_frequency(kTable, last, idx);
+            last = idx;
+            uniqueKeys++;
+        }
+
+    return minGames > 1 ? prune_keys(kTable, minGames) : uniqueKeys;
+}
+
+/// A sharded book is made of 2^bits books, the shards, each one with the keys
+/// of the same top 'bits' bits, and of a manifest listing them in key order.
+/// The manifest starts with a "# shards <bits>" line, then find routes a key
+/// to its shard, and is otherwise a manifest of books as any other.
+
+std::string shard_name(const std::string& stem, size_t shard) {
+    return stem + ".shard" + std::to_string(shard) + ".bin";
+}
+
+inline size_t shard_of(Key key, int bits) {
+    return size_t(key >> (64 - bits));
+}
+
+/// shard_bits() returns the number of key bits of a sharded book manifest, or
+/// 0 if the manifest is not one of a sharded book.
+
+int shard_bits(const std::string& manifestName) {
+
+    std::ifstream manifest(manifestName);
+    std::string hash, tag;
+    int bits = 0;
+
+    return manifest >> hash >> tag >> bits && hash == "#" && tag == "shards" ? bits : 0;
+}
+
+/// ShardedBook is the book of a query on a single position or line: a plain
+/// book, or all the shards of a sharded book, each key being in one of them.
+
+struct ShardedBook {
+    std::vector<std::shared_ptr<const MappedBook>> shards;
+    int bits = 0;
+
+    const MappedBook& of(Key key) const { return *shards[bits ? shard_of(key, bits) : 0]; }
+};
+
+/// open_sharded() maps a plain book or the shards of a sharded book. Lists of
+/// books and other manifests are only searched by find. Returns an error
+/// message, empty on success.
+
+std::string open_sharded(const std::string& bookName, ShardedBook& book) {
+
+    std::vector<std::string> names = { bookName };
+
+    if (   bookName.find(',') != std::string::npos
+        || bookName.size() < 4 || bookName.compare(bookName.size() - 4, 4, ".bin"))
+    {
+        names.clear();
+        std::string error = book_list(bookName, names);
+
+        if (!error.empty())
+            return error;
+
+        book.bits = bookName.find(',') == std::string::npos ? shard_bits(bookName) : 0;
+
+        if (!book.bits || names.size() != size_t(1) << book.bits)
+            return "Only find searches lists of books: " + bookName;
+    }
+
+    for (const std::string& name : names)
+    {
+        book.shards.push_back(Books::open(name));
+
+        if (!book.shards.back())
+            return "Could not map " + name;
+    }
+
+    return "";
+}
+
+/// probe_sorted() looks up all the given keys in key order, with a single
+/// forward sweep over the book, and calls f(i, shard, idx) with the shard of
+/// keys[i] and the index of its first entry, or shard.size() if the key is not
+/// in the book. Keys of a shard are contiguous in key order, so each shard is
+/// swept once too.
+
+template<typename F>
+void probe_sorted(const ShardedBook& book, const std::vector<Key>& keys, F f) {
+
+    std::vector<size_t> order(keys.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return keys[a] < keys[b];
+    });
+
+    const MappedBook* shard = nullptr;
+    size_t idx = 0;
+
+    for (size_t i : order)
+    {
+        if (&book.of(keys[i]) != shard)
+            shard = &book.of(keys[i]), idx = 0;
+
+        if (!shard->may_contain(keys[i]))
+        {
+            f(i, *shard, shard->size());
+            continue;
+        }
+
+        idx = shard->gallop(keys[i], idx);
+        f(i, *shard, idx < shard->size() && shard->key(idx) == keys[i] ? idx : shard->size());
+    }
+}
+
+/// length_name() returns the name of the sidecar recording how much of its PGN
+/// file a book indexes: the size of the PGN, the offset where parsing resumes,
+/// the size of the book, whether it is full and whether the last game was
+/// complete. Games appended to the PGN can then be indexed alone. Books written
+/// before posting lists were sorted by 'learn' have none, see MappedBook::open().
+
+std::string length_name(const std::string& bookName) {
+
+    size_t lastdot = bookName.find_last_of(".");
+    return bookName.substr(0, lastdot) + ".len";
+}
+
+/// write_length() writes the .len sidecar of a book not built out of a whole
+/// PGN file, as a merge or a shard, with no PGN size and a last game not
+/// complete, so that it is never appended to.
+
+void write_length(const std::string& bookName, uint64_t bookSize, bool full) {
+    std::ofstream(length_name(bookName)) << "0 0 " << bookSize << " " << full << " 0\n";
+}
+
+/// write_shards() writes the entries of a parsed PGN as a sharded book, with an
+/// optional filter per shard. Entries are first partitioned by shard, then the
+/// shards are sorted, pruned of the moves of less than 'minGames' games and
+/// written in parallel. Returns the total size of the shards, and sets the
+/// number of unique keys and the total size of filters.
+
+size_t write_shards(Keys& kTable, const std::string& stem, int bits, bool full, double fpr,
+                    size_t minGames, size_t& uniqueKeys, size_t& filterSize) {
+
+    std::vector<Keys> shards(size_t(1) << bits);
+    std::vector<size_t> sizes(shards.size()), keys(shards.size()), filters(shards.size());
+
+    for (const PolyEntry& e : kTable)
+        sizes[shard_of(e.key, bits)]++;
+
+    for (size_t i = 0; i < shards.size(); ++i)
+        shards[i].reserve(sizes[i]);
+
+    for (const PolyEntry& e : kTable)
+        shards[shard_of(e.key, bits)].push_back(e);
+
+    Keys().swap(kTable);
+
+    parallel_for(shards.size(), [&](size_t i) {
+        std::string name = shard_name(stem, i);
+
+        keys[i] = sort_keys(shards[i], minGames);
+        sizes[i] = write_poly_file(shards[i], name + ".tmp", full);
+
+        std::remove(MinimalPerfectHash::sidecar(name).c_str());
+        std::remove(BloomFilter::sidecar(name).c_str());
+        std::remove(HotTable::sidecar(name).c_str());
+        replace_file(name + ".tmp", name);
+        write_length(name, sizes[i], full);
+
+        if (fpr > 0)
+        {
+            std::vector<Key> unique;
+            unique.reserve(keys[i]);
+            for (const PolyEntry& e : shards[i])
+                if (unique.empty() || e.key != unique.back())
+                    unique.push_back(e.key);
+
+            filters[i] = BloomFilter::build(unique, fpr, sizes[i], BloomFilter::sidecar(name));
+        }
+
+        Keys().swap(shards[i]);
+    });
+
+    std::string manifestName = stem + ".shards";
+    std::ofstream manifest(manifestName + ".tmp");
+    std::string base = stem.substr(stem.find_last_of("/\\") + 1);
+
+    manifest << "# shards " << bits << "\n";
+    for (size_t i = 0; i < shards.size(); ++i)
+        manifest << shard_name(base, i) << "\n";
+
+    manifest.close();
+    replace_file(manifestName + ".tmp", manifestName);
+
+    uniqueKeys = filterSize = 0;
+    size_t bookSize = 0;
+
+    for (size_t i = 0; i < shards.size(); ++i)
+    {
+        uniqueKeys += keys[i];
+        filterSize += filters[i];
+        bookSize += sizes[i];
+    }
+
+    return bookSize;
+}
+
+/// is_full_book() tells whether a book has an entry per game of each move, as
+/// merge_books() needs to add up game counts. The .len sidecar says so, when
+/// still matching the book, otherwise the weights of each position must be
+/// those sort_by_frequency() computes out of its entries: a book with only the
+/// first entry of each move fails as soon as a position has more than 2 games.
+
+bool is_full_book(const MappedBook& book, const std::string& bookName) {
+
+    std::ifstream len(length_name(bookName));
+    uint64_t pgnSize, resume, bookSize;
+    bool full;
+
+    if (   len >> pgnSize >> resume >> bookSize >> full
+        && bookSize == book.size() * SizeOfPolyEntry)
+        return full;
+
+    std::map<PMove, size_t> moves;
+
+    for (size_t idx = 0, end; idx < book.size(); idx = end)
+    {
+        Key key = book.key(idx);
+
+        moves.clear();
+        for (end = idx; end < book.size() && book.key(end) == key; ++end)
+            moves[book[end].move]++;
+
+        size_t total = end - idx;
+
+        for (size_t i = idx; i < end; ++i)
+            if (book[i].weight != (total > 2 ? moves[book[i].move] * 0xFFFF / total : 1))
+                return false;
+    }
+
+    return true;
+}
+
+/// A checkpointed build parses the PGN a chunk at a time, spilling each chunk
+/// to a sorted run, and records after each run in a .ckp file the PGN size and
+/// time, where parsing goes on, the counters so far and the runs written, with
+/// their size. A build that died can then be resumed from the last checkpoint.
+
+std::string checkpoint_name(const std::string& bookName) {
+
+    size_t lastdot = bookName.find_last_of(".");
+    return bookName.substr(0, lastdot) + ".ckp";
+}
+
+struct Checkpoint {
+    uint64_t pgnSize, pgnTime, next;
+    Stats stats;
+    std::vector<std::string> runs;
+};
+
+bool read_checkpoint(const std::string& fName, Checkpoint& ckp) {
+
+    std::ifstream ifs(fName);
+    std::string run;
+    uint64_t runSize;
+
+    if (!(ifs >> ckp.pgnSize >> ckp.pgnTime >> ckp.next
+              >> ckp.stats.games >> ckp.stats.moves >> ckp.stats.fixed))
+        return false;
+
+    while (ifs >> run >> runSize)
+    {
+        if (file_size(run) != runSize)
+            return false;
+
+        ckp.runs.push_back(run);
+    }
+
+    return ifs.eof();
+}
+
+bool write_checkpoint(const std::string& fName, const Checkpoint& ckp) {
+
+    std::ofstream ofs(fName + ".tmp");
+    ofs << ckp.pgnSize << " " << ckp.pgnTime << " " << ckp.next << " " << ckp.stats.games << " "
+        << ckp.stats.moves << " " << ckp.stats.fixed << "\n";
+
+    for (const std::string& run : ckp.runs)
+        ofs << run << " " << file_size(run) << "\n";
+
+    ofs.close();
+    return ofs && replace_file(fName + ".tmp", fName);
+}
+
+/// parse_checkpointed() parses a PGN as parse_pgn() does, 'checkpoint' bytes
+/// at a time, each chunk ending where a game starts, so that the chunks split
+/// the games as a single parse does. All but the last chunk are written to
+/// runs, returned in 'runs', the last one is left in 'kTable'. With 'resume',
+/// parsing goes on from the checkpoint of the book, if it is still valid, that
+/// is if the PGN did not change since and its runs are all there. 'start' is
+/// then set to the offset parsing resumed from.
+
+std::string parse_checkpointed(void* baseAddress, uint64_t size, const std::string& pgnName,
+                               const std::string& bookName, const BuildOptions& o,
+                               uint64_t& start, Stats& stats, Keys& kTable,
+                               std::vector<std::string>& runs, Progress& progress) {
+
+    std::string ckpName = checkpoint_name(bookName);
+    Checkpoint ckp = {};
+
+    if (   !o.resume
+        || !read_checkpoint(ckpName, ckp)
+        || ckp.pgnSize != size
+        || ckp.pgnTime != file_time(pgnName)
+        || ckp.next > size)
+    {
+        if (o.resume)
+            *progress.log << "\nCannot resume from " << ckpName << ", rebuilding";
+
+        ckp = Checkpoint();
+        ckp.pgnSize = size;
+        ckp.pgnTime = file_time(pgnName);
+    }
+    else
+        *progress.log << "\nResuming from offset " << ckp.next;
+
+    start = ckp.next;
+    progress.bytes = ckp.next, progress.games = ckp.stats.games;
+
+    for (uint64_t ofs = ckp.next; ; ofs = ckp.next)
+    {
+        uint64_t end = game_start((const char*)baseAddress, size, ofs + o.checkpoint);
+        Stats chunk = {};
+
+        if (end <= ofs) // Only past a gap wider than a chunk between two games
+            end = size;
+
+        kTable.clear();
+        parse_pgn(baseAddress, end, chunk, kTable, progress, ofs, o.maxPly);
+
+        ckp.next = end;
+        ckp.stats.games += chunk.games;
+        ckp.stats.moves += chunk.moves;
+        ckp.stats.fixed += chunk.fixed;
+        stats = ckp.stats;
+        stats.resume = chunk.resume;
+        stats.clean = chunk.clean;
+
+        if (end == size)
+            break;
+
+        // A run cannot be empty, as an empty file cannot be mapped
+        if (!kTable.empty())
+        {
+            std::string runName = ckpName + std::to_string(ckp.runs.size()) + ".bin";
+            sort_keys(kTable);
+            write_poly_file(kTable, runName + ".tmp", true);
+
+            if (!replace_file(runName + ".tmp", runName))
+                return "Could not write " + runName;
+
+            ckp.runs.push_back(runName);
+        }
+
+        if (!write_checkpoint(ckpName, ckp))
+            return "Could not write " + ckpName;
+    }
+
+    runs = ckp.runs;
+    return "";
+}
+
+/// build_book() indexes a PGN file into a Polyglot book, keeping 'progress'
+/// updated along the way. With 'append', only the games added to the PGN since
+/// the book was built are parsed, then merged into the book: the result is the
+/// same as a full rebuild. When the book cannot be appended to, because it is
+/// not a full one, the PGN did not grow or the last game indexed was cut short,
+/// the book is rebuilt. With 'shardBits', a sharded book is built instead, see
+/// write_shards(). With a range, a run of the games starting in it is written,
+/// to be merged with the runs of the other ranges by "reduce". With a
+/// checkpoint size, the PGN is parsed into runs merged at the end, and the
+/// build can be resumed, see parse_checkpointed(). Returns an error message,
+/// empty on success.
+
+std::string build_book(std::string pgnName, const BuildOptions& o, std::ostream& os,
+                       Progress& progress) {
+
+    Keys kTable;
+    Stats stats;
+    uint64_t mapping, size, start = 0;
+    void* baseAddress;
+
+    progress.size = file_size(pgnName);
+
+    if (!progress.size) // Would make map() fail
+        return "Could not open " + pgnName;
+
+    std::string bookName = pgnName.substr(0, pgnName.find_last_of(".")) + ".bin";
+
+    bool append = o.append;
+
+    if (append)
+    {
+        std::ifstream len(length_name(bookName));
+        uint64_t pgnSize = 0, resume = 0, bookSize = 0;
+        bool wasFull = false, clean = false;
+
+        append =    len >> pgnSize >> resume >> bookSize >> wasFull >> clean
+                 && o.full && wasFull && clean
+                 && pgnSize < progress.size && bookSize == file_size(bookName);
+
+        if (append)
+            start = resume;
+        else
+            *progress.log << "\nCannot append to " << bookName << ", rebuilding it";
+    }
+
+    if (!map(pgnName.c_str(), &baseAddress, &mapping, &size))
+        return "Could not map " + pgnName;
+
+    // A run of a map/reduce build indexes only the games starting in its range
+    if (o.rangeEnd)
+    {
+        start = game_start((const char*)baseAddress, size, o.rangeStart);
+        size = std::max(start, game_start((const char*)baseAddress, size, o.rangeEnd));
+        bookName =  pgnName.substr(0, pgnName.find_last_of(".")) + "."
+                  + std::to_string(o.rangeStart) + "-" + std::to_string(o.rangeEnd) + ".bin";
+    }
+
+    // Reserve enough capacity according to file size. This is a very crude
+    // estimation, mainly we assume key index to be of 2 times the size of
+    // the pgn file. An archive takes about a byte per entry, a move list 5.
+    bool fromArchive = is_archive(pgnName), fromMoves = is_move_list(pgnName);
+    kTable.reserve(  fromArchive ? size
+                   : fromMoves   ? size / 5 : 2 * (size - start) / sizeof(PolyEntry));
+
+    *progress.log << "\nProcessing...";
+
+    TimePoint elapsed = now();
+
+    std::vector<std::string> runs;
+    std::string archive;
+
+    if (fromArchive)
+    {
+        if (!parse_archive(baseAddress, size, stats, kTable, progress, o.maxPly))
+        {
+            unmap(baseAddress, mapping);
+            return "Corrupted archive " + pgnName;
+        }
+    }
+    else if (fromMoves)
+        parse_lan(baseAddress, size, stats, kTable, progress, o.maxPly);
+
+    else if (!o.checkpoint)
+    {
+        if (o.archive)
+            archive.reserve(size / 8);
+
+        parse_pgn(baseAddress, size, stats, kTable, progress, start, o.maxPly,
+                  o.archive ? &archive : nullptr);
+    }
+    else
+    {
+        std::string err = parse_checkpointed(baseAddress, size, pgnName, bookName, o,
+                                             start, stats, kTable, runs, progress);
+        if (!err.empty())
+        {
+            unmap(baseAddress, mapping);
+            return err;
+        }
+    }
+
+    elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+
+    unmap(baseAddress, mapping);
+
+    size_t uniqueKeys, bookSize, filterSize = 0, hotSize = 0, archiveSize = 0;
+
+    if (o.archive)
+    {
+        std::string archiveName = pgnName.substr(0, pgnName.find_last_of(".")) + ".cdb";
+        std::ofstream ofs(archiveName + ".tmp", std::ofstream::out | std::ofstream::binary);
+        ofs.write(ArchiveMagic, 8);
+        ofs.write(archive.data(), archive.size());
+        archiveSize = ofs.tellp();
+        ofs.close();
+
+        if (!ofs || !replace_file(archiveName + ".tmp", archiveName))
+            return "Could not write " + archiveName;
+
+        std::string().swap(archive);
+    }
+
+    if (o.shardBits)
+    {
+        *progress.log << "done\nWriting shards...";
+        progress.stage = WRITING;
+
+        std::string stem = bookName.substr(0, bookName.find_last_of("."));
+        bookSize = write_shards(kTable, stem, o.shardBits, o.full, o.fpr, o.minGames,
+                                uniqueKeys, filterSize);
+        bookName = stem + ".shards";
+    }
+    else if (o.rangeEnd)
+    {
+        *progress.log << "done\nSorting...";
+        progress.stage = SORTING;
+
+        uniqueKeys = sort_keys(kTable);
+
+        // Runs are always full, so that reduce can recompute the weights
+        *progress.log << "done\nWriting run...";
+        progress.stage = WRITING;
+
+        bookSize = write_poly_file(kTable, bookName + ".tmp", true);
+
+        if (!replace_file(bookName + ".tmp", bookName))
+            return "Could not write " + bookName;
+    }
+    else
+    {
+        *progress.log << "done\nSorting...";
+        progress.stage = SORTING;
+
+        // The last chunk of a checkpointed build is pruned only once merged
+        uniqueKeys = sort_keys(kTable, runs.empty() ? o.minGames : 0);
+
+        *progress.log << "done\nWriting Polygot book...";
+        progress.stage = WRITING;
+
+        // The book is written aside then renamed over the previous one, so that
+        // readers never see a partly written book. Those still running on the
+        // previous one keep it mapped until they are done.
+        std::string tmpName = bookName + ".tmp";
+
+        if (!runs.empty())
+        {
+            // The last chunk joins the runs of the previous ones, then all of
+            // them are merged as reduce does.
+            if (!kTable.empty())
+            {
+                runs.push_back(checkpoint_name(bookName) + std::to_string(runs.size()) + ".bin");
+                write_poly_file(kTable, runs.back(), true);
+            }
+
+            std::vector<std::unique_ptr<MappedBook>> books;
+            std::vector<const MappedBook*> inputs;
+
+            for (const std::string& run : runs)
+            {
+                books.emplace_back(new MappedBook());
+                if (!books.back()->open(run))
+                    return "Could not open run " + run;
+
+                inputs.push_back(books.back().get());
+            }
+
+            std::ofstream ofs(tmpName, std::ofstream::out | std::ofstream::binary);
+            uniqueKeys = merge_books(inputs, std::vector<uint32_t>(inputs.size(), 0), o.full, ofs,
+                                     o.minGames);
+            bookSize = ofs.tellp();
+            ofs.close();
+        }
+        else if (!append)
+            bookSize = write_poly_file(kTable, tmpName, o.full);
+        else
+        {
+            // The new games are merged in as if they were another book, with the
+            // same game offsets they have in the PGN.
+            std::string tailName = bookName + ".tail";
+            write_poly_file(kTable, tailName, true);
+
+            MappedBook book, tail;
+            if (!book.open(bookName) || !tail.open(tailName))
+                return "Could not map " + bookName;
+
+            std::ofstream ofs(tmpName, std::ofstream::out | std::ofstream::binary);
+            merge_books({ &book, &tail }, { 0, 0 }, true, ofs);
+            bookSize = ofs.tellp();
+            ofs.close();
+
+            book.close(); // Needed on Windows to rename over it
+            tail.close();
+            std::remove(tailName.c_str());
+        }
+
+        // Sidecars of the previous book would point to wrong entries of the new one
+        std::remove(MinimalPerfectHash::sidecar(bookName).c_str());
+        std::remove(BloomFilter::sidecar(bookName).c_str());
+        std::remove(HotTable::sidecar(bookName).c_str());
+
+        if (!replace_file(tmpName, bookName))
+            return "Could not write " + bookName;
+
+        // Once the book is there, the checkpoint has no further use
+        if (o.checkpoint)
+        {
+            for (const std::string& run : runs)
+                std::remove(run.c_str());
+
+            std::remove(checkpoint_name(bookName).c_str());
+        }
+
+        drop_live(bookName);
+
+        // Only a book built out of a PGN can be appended to
+        if (fromArchive || fromMoves)
+            write_length(bookName, bookSize, o.full);
+        else
+            std::ofstream(length_name(bookName)) << size << " " << stats.resume << " " << bookSize << " "
+                                                 << o.full << " " << stats.clean << "\n";
+
+        if (o.fpr > 0)
+        {
+            *progress.log << "done\nWriting filter...";
+            progress.stage = FILTERING;
+
+            MappedBook book;
+            if (!book.open(bookName))
+                return "Could not map " + bookName;
+
+            std::vector<Key> keys;
+            keys.reserve(uniqueKeys);
+            for (size_t idx = 0; idx < book.size(); ++idx)
+                if (keys.empty() || book.key(idx) != keys.back())
+                    keys.push_back(book.key(idx));
+
+            filterSize = BloomFilter::build(keys, o.fpr, bookSize, BloomFilter::sidecar(bookName));
+        }
+
+        if (o.hotPositions)
+        {
+            *progress.log << "done\nWriting hot table...";
+
+            MappedBook book;
+            if (!book.open(bookName))
+                return "Could not map " + bookName;
+
+            hotSize = HotTable::build(book, o.hotPositions, o.hotGames, bookSize, HotTable::sidecar(bookName));
+        }
+    }
+
+    *progress.log << "done\n" << std::endl;
+
+    // Output probing info in JSON format. When appending, games and moves are
+    // those of the new games only, when resuming those of the whole PGN.
+    std::string tab = "\n    ";
+    std::stringstream json;
+    json << "{"
+         << tab << "\"Games\": " << stats.games << ","
+         << tab << "\"Moves\": " << stats.moves << ","
+         << tab << "\"Incorrect moves\": " << stats.fixed << ","
+         << tab << "\"Unique positions (%)\": " << (stats.moves ? 100 * uniqueKeys / stats.moves : 0) << ","
+         << tab << "\"Games/second\": " << 1000 * stats.games / elapsed << ","
+         << tab << "\"Moves/second\": " << 1000 * stats.moves / elapsed << ","
+         << tab << "\"MBytes/second\": " << float(size - start) / elapsed / 1000 << ","
+         << tab << "\"Appended from offset\": " << (append ? std::to_string(start) : "null") << ","
+         << tab << "\"Resumed from offset\": " << (o.resume && start ? std::to_string(start) : "null") << ","
+         << tab << "\"Size of index file (bytes)\": " << bookSize << ","
+         << tab << "\"Size of filter file (bytes)\": " << filterSize << ","
+         << tab << "\"Size of hot table file (bytes)\": " << hotSize << ","
+         << tab << "\"Size of archive file (bytes)\": " << archiveSize << ","
+         << tab << "\"Book file\": \"" << bookName << "\","
+         << tab << "\"Processing time (ms)\": " << elapsed << "\n"
+         << "}";
+
+    os << json.str() << std::endl;
+    return "";
+}
+
+/// ingest_pgn() indexes the games added to a PGN file since the last call into
+/// its live index, created on first use on top of the book of the PGN, if any.
+/// The book must then be a full one, built by "book" out of the same file. From
+/// then on, find on the book also searches the ingested games. The last game
+/// is indexed only when complete, as it may still be being written: parsing
+/// resumes from its start next time. 'progress' gets the bytes ingested so far,
+/// the size of the PGN and the games added.
+
+std::string ingest_pgn(const std::string& pgnName, size_t flushEntries,
+                       std::ostream& os, Progress& progress) {
+
+    std::string stem = pgnName.substr(0, pgnName.find_last_of("."));
+    std::string bookName = stem + ".bin";
+    std::shared_ptr<LiveIndex> index;
+
+    {
+        std::lock_guard<std::mutex> lock(LiveMutex);
+        std::shared_ptr<LiveIndex>& idx = LiveIndexes[bookName];
+
+        if (!idx)
+        {
+            std::ifstream len(length_name(bookName));
+            uint64_t pgnSize = 0, resume = 0, bookSize = 0;
+            bool full = false, clean = false;
+
+            if (   file_size(bookName)
+                && !(   len >> pgnSize >> resume >> bookSize >> full >> clean
+                     && full && clean && bookSize == file_size(bookName)))
+            {
+                LiveIndexes.erase(bookName);
+                return "Cannot ingest into " + bookName + ", rebuild it with 'book " + pgnName + " full'";
+            }
+
+            std::shared_ptr<const MappedBook> book = Books::open(bookName);
+
+            if (!book)
+            {
+                LiveIndexes.erase(bookName);
+                return "Could not map " + bookName;
+            }
+
+            idx = std::make_shared<LiveIndex>();
+            idx->stem = stem;
+            idx->ingested = resume;
+            idx->flushEntries = 1 << 16;
+            idx->compacting = false;
+            idx->snapshot = std::make_shared<const LiveSnapshot>(LiveSnapshot{
+                ++LiveSnapshots, book, {}, {}, std::make_shared<const Keys>() });
+        }
+
+        index = idx;
+    }
+
+    std::lock_guard<std::mutex> lock(index->mutex);
+
+    if (flushEntries)
+        index->flushEntries = flushEntries;
+
+    uint64_t size = file_size(pgnName), start = index->ingested;
+    Keys kTable;
+    Stats stats = {};
+
+    if (size > start)
+    {
+        uint64_t mapping;
+        void* baseAddress;
+        Progress parsing = {};
+        parsing.log = progress.log;
+
+        if (!map(pgnName.c_str(), &baseAddress, &mapping, &size))
+            return "Could not map " + pgnName;
+
+        parse_pgn(baseAddress, size, stats, kTable, parsing, start);
+        unmap(baseAddress, mapping);
+
+        // Drop a last game cut short, it is parsed again on next ingest
+        if (!stats.clean)
+        {
+            uint32_t ofs = uint32_t(stats.resume >> 3) & 0x3FFFFFFF;
+            kTable.erase(std::remove_if(kTable.begin(), kTable.end(), [&](const PolyEntry& e) {
+                return (e.learn & 0x3FFFFFFF) == ofs;
+            }), kTable.end());
+            stats.games--;
+        }
+
+        index->ingested = stats.resume;
+    }
+
+    progress.bytes = index->ingested, progress.size = size;
+    progress.games += stats.games;
+
+    // When nothing new was indexed, the snapshot and its cached results stay valid
+    if (!kTable.empty())
+    {
+        const LiveSnapshot& cur = *index->snapshot;
+        LiveSnapshot* next = new LiveSnapshot(cur);
+        std::shared_ptr<Keys> delta = std::make_shared<Keys>();
+
+        std::sort(kTable.begin(), kTable.end(), live_order);
+        delta->reserve(cur.delta->size() + kTable.size());
+        std::merge(cur.delta->begin(), cur.delta->end(), kTable.begin(), kTable.end(),
+                   std::back_inserter(*delta), live_order);
+
+        if (delta->size() >= index->flushEntries)
+        {
+            std::string runName = run_name(stem);
+            write_poly_file(*delta, runName, true);
+
+            std::shared_ptr<MappedBook> run = std::make_shared<MappedBook>();
+            if (run->open(runName))
+            {
+                next->runs.push_back(run);
+                next->runNames.push_back(runName);
+                delta->clear();
+            }
+            else // Kept in memory until the next flush
+                std::remove(runName.c_str());
+        }
+
+        next->delta = delta;
+        publish(*index, next);
+    }
+
+    if (index->snapshot->runs.size() > MaxRuns && !index->compacting)
+    {
+        if (index->compactor.joinable())
+            index->compactor.join();
+
+        index->compacting = true;
+        index->compactor = std::thread(compact, std::ref(*index), index->snapshot);
+    }
+
+    std::string tab = "\n    ";
+    std::stringstream json;
+    json << "{"
+         << tab << "\"Games\": " << stats.games << ","
+         << tab << "\"Ingested from offset\": " << start << ","
+         << tab << "\"Ingested up to offset\": " << index->ingested << ","
+         << tab << "\"Delta entries\": " << index->snapshot->delta->size() << ","
+         << tab << "\"Runs\": " << index->snapshot->runs.size() << ","
+         << tab << "\"Book file\": " << json_string(bookName) << "\n"
+         << "}";
+
+    os << json.str() << std::endl;
+    return "";
+}
+
+
+/// follow() keeps the live index of a PGN file up to date while the file is
+/// being written, ingesting the games added each time the file changes, until
+/// the job is stopped. The lag is the time from the last write to the file to
+/// the end of the ingest that made its games searchable.
+
+void follow(Job* job) {
+
+    FileWatch watch(job->pgnName);
+    std::stringstream ss;
+
+    for (bool changed = true; !job->stop; changed = watch.wait(200))
+    {
+        if (!changed)
+            continue;
+
+        uint64_t written = file_time(job->pgnName);
+
+        ss.str("");
+        job->error = ingest_pgn(job->pgnName, 0, ss, job->progress);
+
+        if (!job->error.empty())
+            break;
+
+        uint64_t ingested = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::system_clock::now().time_since_epoch()).count();
+        job->lag = ingested > written ? TimePoint((ingested - written) / 1000000) : 0;
+    }
+
+    job->output = ss.str();
+    job->elapsed = now() - job->start;
+    job->progress.stage = job->error.empty() ? DONE : FAILED;
+}
+
+} // namespace
+
+const char* play_game(const Position& pos, Move move, const char* cur, const char* end) {
+
+    size_t fixed;
+    Keys k;
+    StateInfo st;
+    Position p = pos;
+    p.do_move(move, st, pos.gives_check(move));
+    while (*cur++) {} // Move to next move in game
+    return cur < end ? parse_game<true>(cur, end, k, p.fen().c_str(),
+                                        nullptr, fixed, 0, 3, std::cerr) : cur;
+}
+
+namespace Parser {
+
+
+void init() {
+
+    static StateInfo st;
+    const char* startFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+    RootPos.set(startFEN, false, &st);
+
+    ToToken['\n'] = ToToken['\r'] = ToToken[' '] = ToToken['\t'] = T_SPACES;
+    ToToken['/'] = ToToken['*'] = T_RESULT;
+    ToToken['-'] = T_MINUS;
+    ToToken['.'] = T_DOT;
+    ToToken['"'] = T_QUOTES;
+    ToToken['$'] = T_DOLLAR;
+    ToToken['['] = T_LEFT_BRACKET;
+    ToToken[']'] = T_RIGHT_BRACKET;
+    ToToken['{'] = T_LEFT_BRACE;
+    ToToken['}'] = T_RIGHT_BRACE;
+    ToToken['('] = T_LEFT_PARENTHESIS;
+    ToToken[')'] = T_RIGHT_PARENTHESIS;
+    ToToken['E'] = T_EVENT;
+    ToToken['0'] = T_ZERO;
+    ToToken['1'] = ToToken['2'] = ToToken['3'] =
+    ToToken['4'] = ToToken['5'] = ToToken['6'] = ToToken['7'] =
+    ToToken['8'] = ToToken['9'] = T_DIGIT;
+    ToToken['a'] = ToToken['b'] = ToToken['c'] = ToToken['d'] =
+    ToToken['e'] = ToToken['f'] = ToToken['g'] = ToToken['h'] =
+    ToToken['N'] = ToToken['B'] = ToToken['R'] = ToToken['Q'] =
+    ToToken['K'] = ToToken['O'] = ToToken['o'] = T_MOVE_HEAD;
+
+    // Trailing move notations are ignored because SAN detector
+    // does not need them and in some malformed PGN they appear
+    // one blank apart from the corresponding move.
+    ToToken['!'] = ToToken['?'] = ToToken['+'] = ToToken['#'] = T_SPACES;
+
+    // STATE = HEADER
+    //
+    // Between tags, before game starts. Accept anything
+    for (int i = 0; i < TOKEN_NB; i++)
+        ToStep[HEADER][i] = CONTINUE;
+
+    ToStep[HEADER][T_LEFT_BRACKET] = OPEN_TAG;
+    ToStep[HEADER][T_LEFT_BRACE  ] = OPEN_BRACE_COMMENT;
+    ToStep[HEADER][T_DIGIT       ] = START_MOVE_NUMBER;
+    ToStep[HEADER][T_ZERO        ] = START_RESULT;
+    ToStep[HEADER][T_RESULT      ] = START_RESULT;
+
+    // STATE = TAG
+    //
+    // Between brackets in header section, generic tag
+    for (int i = 0; i < TOKEN_NB; i++)
+        ToStep[TAG][i] = CONTINUE;
+
+    ToStep[TAG][T_RIGHT_BRACKET] = POP_STATE;
+
+    // STATE = FEN_TAG
+    //
+    // Special tag to set a position from a FEN string
+    for (int i = 0; i < TOKEN_NB; i++)
+        ToStep[FEN_TAG][i] = READ_FEN;
+
+    ToStep[FEN_TAG][T_QUOTES] = CLOSE_FEN_TAG;
+
+    // STATE = BRACE_COMMENT
+    //
+    // Comment in braces, can appear almost everywhere. Note that brace comments
+    // do not nest according to PGN standard.
+    for (int i = 0; i < TOKEN_NB; i++)
+        ToStep[BRACE_COMMENT][i] = CONTINUE;
+
+    ToStep[BRACE_COMMENT][T_RIGHT_BRACE ] = POP_STATE;
+    ToStep[BRACE_COMMENT][T_LEFT_BRACKET] = TAG_IN_BRACE; // Missed closing brace
+
+    // STATE = VARIATION
+    //
+    // For the moment variations are ignored
+    for (int i = 0; i < TOKEN_NB; i++)
+        ToStep[VARIATION][i] = CONTINUE;
+
+    ToStep[VARIATION][T_RIGHT_PARENTHESIS] = POP_STATE;
+    ToStep[VARIATION][T_LEFT_PARENTHESIS ] = OPEN_VARIATION; // Nested
+    ToStep[VARIATION][T_LEFT_BRACE       ] = OPEN_BRACE_COMMENT;
+
+    // STATE = NUMERIC_ANNOTATION_GLYPH
+    //
+    // Just read a single number
+    for (int i = 0; i < TOKEN_NB; i++)
+        ToStep[NUMERIC_ANNOTATION_GLYPH][i] = POP_STATE;
+
+    ToStep[NUMERIC_ANNOTATION_GLYPH][T_ZERO ] = CONTINUE;
+    ToStep[NUMERIC_ANNOTATION_GLYPH][T_DIGIT] = CONTINUE;
+
+    // STATE = NEXT_MOVE
+    //
+    // Check for the beginning of the next move number
+    for (int i = 0; i < TOKEN_NB; i++)
+        ToStep[NEXT_MOVE][i] = CONTINUE;
+
+    ToStep[NEXT_MOVE][T_LEFT_PARENTHESIS] = OPEN_VARIATION;
+    ToStep[NEXT_MOVE][T_LEFT_BRACE      ] = OPEN_BRACE_COMMENT;
+    ToStep[NEXT_MOVE][T_LEFT_BRACKET    ] = MISSING_RESULT;
+    ToStep[NEXT_MOVE][T_DOLLAR          ] = START_NAG;
+    ToStep[NEXT_MOVE][T_RESULT          ] = START_RESULT;
+    ToStep[NEXT_MOVE][T_ZERO            ] = START_RESULT;
+    ToStep[NEXT_MOVE][T_DOT             ] = FAIL;
+    ToStep[NEXT_MOVE][T_MOVE_HEAD       ] = FAIL;
+    ToStep[NEXT_MOVE][T_MINUS           ] = FAIL;
+    ToStep[NEXT_MOVE][T_DIGIT           ] = START_MOVE_NUMBER;
+
+    // STATE = MOVE_NUMBER
+    //
+    // Continue until a dot is found, to tolerate missing dots,
+    // stop at first space, then start NEXT_SAN that will handle
+    // head trailing spaces. We can alias with a result like 1-0 or 1/2-1/2
+    ToStep[MOVE_NUMBER][T_ZERO  ] = CONTINUE;
+    ToStep[MOVE_NUMBER][T_DIGIT ] = CONTINUE;
+    ToStep[MOVE_NUMBER][T_RESULT] = START_RESULT;
+    ToStep[MOVE_NUMBER][T_MINUS ] = START_RESULT;
+    ToStep[MOVE_NUMBER][T_SPACES] = START_NEXT_SAN;
+    ToStep[MOVE_NUMBER][T_DOT   ] = START_NEXT_SAN;
+
+    // STATE = NEXT_SAN
+    //
+    // Check for the beginning of the next move SAN
+    for (int i = 0; i < TOKEN_NB; i++)
+        ToStep[NEXT_SAN][i] = CONTINUE;
+
+    ToStep[NEXT_SAN][T_LEFT_PARENTHESIS] = OPEN_VARIATION;
+    ToStep[NEXT_SAN][T_LEFT_BRACE      ] = OPEN_BRACE_COMMENT;
+    ToStep[NEXT_SAN][T_LEFT_BRACKET    ] = MISSING_RESULT;
+    ToStep[NEXT_SAN][T_DOLLAR          ] = START_NAG;
+    ToStep[NEXT_SAN][T_RESULT          ] = START_RESULT;
+    ToStep[NEXT_SAN][T_ZERO            ] = CASTLE_OR_RESULT;  // 0-0 or 0-1
+    ToStep[NEXT_SAN][T_DOT             ] = CONTINUE;          // Like 4... exd5
+    ToStep[NEXT_SAN][T_DIGIT           ] = START_MOVE_NUMBER; // Same as above
+    ToStep[NEXT_SAN][T_MOVE_HEAD       ] = START_READ_SAN;
+    ToStep[NEXT_SAN][T_MINUS           ] = START_READ_SAN;    // Null move "--"
+
+    // STATE = READ_SAN
+    //
+    // Just read a single move SAN until a space is reached
+    for (int i = 0; i < TOKEN_NB; i++)
+        ToStep[READ_SAN][i] = READ_MOVE_CHAR;
+
+    ToStep[READ_SAN][T_SPACES    ] = END_MOVE;
+    ToStep[READ_SAN][T_LEFT_BRACE] = OPEN_BRACE_COMMENT;
+
+    // STATE = RESULT
+    //
+    // Ignore anything until a space is reached
+    for (int i = 0; i < TOKEN_NB; i++)
+        ToStep[RESULT][i] = CONTINUE;
+
+    ToStep[RESULT][T_SPACES] = END_GAME;
+
+    // STATE = SKIP_GAME
+    //
+    // Ignore anything until start of next game
+    for (int i = 0; i < TOKEN_NB; i++)
+        ToStep[SKIP_GAME][i] = CONTINUE;
+
+    ToStep[SKIP_GAME][T_EVENT] = GAME_START;
+}
+
+/// shutdown() stops the jobs following a PGN, waits for the pending builds and
+/// then for the compactions of the live indexes. It must run before main()
+/// returns, as jobs and compactors use globals that could be destroyed before
+/// the threads themselves.
+
+void shutdown() {
+
+    std::map<int, std::unique_ptr<Job>> jobs;
+    std::map<std::string, std::shared_ptr<LiveIndex>> indexes;
+
+    {
+        std::lock_guard<std::mutex> lock(JobsMutex);
+        jobs.swap(Jobs);
+    }
+
+    jobs.clear(); // Joined out of the lock
+
+    {
+        std::lock_guard<std::mutex> lock(LiveMutex);
+        indexes.swap(LiveIndexes);
+    }
+
+    indexes.clear(); // Out of the lock, as compactors publish under it
+}
+
+/// make_book() builds a book out of a PGN file. With the "async" option the
+/// build runs on its own thread and the command returns at once with a job id,
+/// to be polled with "status", while other commands keep being served. With
+/// "hot N K" the answers of the N most frequent positions, with K game offsets
+/// per move, are precomputed in a sidecar. With "append" only the games added
+/// to the PGN since the last build are parsed. With "shards N" a sharded book
+/// of N shards is built, N being a power of 2. With "range S E" only the games
+/// starting in the byte range [S, E) are indexed. With "maxply N" only the first
+/// N plies of each game are indexed, and with "mingames K" only the moves played
+/// in at least K games are kept. With "checkpoint M" the PGN is parsed M MBytes
+/// at a time, leaving a checkpoint after each chunk, that a later build with
+/// "resume" goes on from. With "archive" the games are also written to a .cdb
+/// archive, that a later "book <name>.cdb" builds the book out of, without
+/// parsing the PGN again. A .uci file of move lists, see parse_lan(), is indexed
+/// as a PGN is. With "follow" a job instead ingests the games added to the PGN
+/// into its live index as they are written, until stopped by "unfollow". A
+/// build is refused while another one of the same book runs.
+
+std::string make_book(std::istringstream& is, std::ostream& os) {
+
+    std::string bookName, token;
+    bool async = false, follow = false, unfollow = false;
+    BuildOptions o = {};
+    size_t shards = 0;
+
+    is >> bookName;
+
+    if (bookName.empty())
+        return "Missing PGN file name...";
+
+    while (is >> token)
+        if (token == "full")
+            o.full = true;
+
+        else if (token == "async")
+            async = true;
+
+        else if (token == "append")
+            o.append = true;
+
+        else if (token == "shards")
+        {
+            if (!(is >> shards) || shards < 2 || shards > 4096 || (shards & (shards - 1)))
+                return "shards must be a power of 2, from 2 to 4096";
+
+            while (size_t(1) << o.shardBits < shards)
+                o.shardBits++;
+        }
+
+        else if (token == "range")
+        {
+            if (!(is >> o.rangeStart >> o.rangeEnd) || o.rangeEnd <= o.rangeStart)
+                return "range needs a start and a greater end offset";
+        }
+
+        else if (token == "checkpoint")
+        {
+            double mb = 0;
+            if (!(is >> mb) || mb * (1 << 20) < 1 || mb > (1 << 20))
+                return "checkpoint needs the MBytes parsed between checkpoints";
+
+            o.checkpoint = uint64_t(mb * (1 << 20));
+        }
+
+        else if (token == "resume")
+            o.resume = true;
+
+        else if (token == "maxply")
+        {
+            if (!(is >> o.maxPly) || o.maxPly <= 0)
+                return "maxply needs the number of plies indexed per game";
+        }
+
+        else if (token == "mingames")
+        {
+            if (!(is >> o.minGames) || !o.minGames)
+                return "mingames needs the number of games a move is kept from";
+        }
+
+        else if (token == "archive")
+            o.archive = true;
+
+        else if (token == "follow")
+            follow = true;
+
+        else if (token == "unfollow")
+            unfollow = true;
+
+        else if (token == "filter")
+        {
+            if (!(is >> o.fpr) || o.fpr <= 0 || o.fpr >= 1)
+                return "filter false positive rate must be between 0 and 1";
+        }
+
+        else if (token == "hot")
+        {
+            if (!(is >> o.hotPositions >> o.hotGames) || !o.hotPositions)
+                return "hot needs the number of positions and of games per move";
+        }
+
+        else
+            return "Unknown option " + token;
+
+    if (o.shardBits && (o.append || o.hotPositions))
+        return "append and hot are not supported with shards";
+
+    if (o.rangeEnd && (o.append || o.hotPositions || o.shardBits || o.fpr > 0 || o.minGames || follow))
+        return "range only builds a run, to be merged by reduce";
+
+    if (o.append && (o.maxPly || o.minGames))
+        return "maxply and mingames are not supported with append";
+
+    if ((o.archive || is_archive(bookName)) && (o.append || o.rangeEnd || o.checkpoint || follow))
+        return "archives are not supported with append, range, checkpoint or follow";
+
+    if (is_move_list(bookName) && (o.append || o.rangeEnd || o.checkpoint || o.archive || follow))
+        return "move lists are not supported with append, range, checkpoint, archive or follow";
+
+    if (o.archive && is_archive(bookName))
+        return "Already an archive: " + bookName;
+
+    if (o.resume && !o.checkpoint)
+        o.checkpoint = DefaultCheckpoint;
+
+    if (o.checkpoint && (o.append || o.shardBits || o.rangeEnd || follow))
+        return "checkpoint is not supported with append, shards, range or follow";
+
+    if (unfollow)
+    {
+        std::lock_guard<std::mutex> lock(JobsMutex);
+
+        for (auto& j : Jobs)
+            if (   j.second->follow && j.second->pgnName == bookName
+                && j.second->progress.stage == FOLLOWING)
+            {
+                j.second->stop = true;
+                j.second->th.join();
+                os << "{\n    \"Job\": " << j.first << "\n}" << std::endl;
+                return "";
+            }
+
+        return "Not following " + bookName;
+    }
+
+    // Two builds of the same book would clobber each other's temporary files
+    std::string target = o.rangeEnd ? bookName + " " + std::to_string(o.rangeStart)
+                                                + "-" + std::to_string(o.rangeEnd) : bookName;
+    std::unique_lock<std::mutex> lock(JobsMutex);
+
+    for (auto& j : Jobs)
+        if (j.second->target == target && j.second->progress.stage < DONE)
+            return (j.second->follow ? "Already following " : "Already building ")
+                   + bookName + " in job " + std::to_string(j.first);
+
+    if (Building.count(target))
+        return "Already building " + bookName;
+
+    if (!async && !follow)
+    {
+        Building.insert(target);
+        lock.unlock();
+
+        Progress progress = {};
+        progress.log = &std::cerr;
+        std::string error = build_book(bookName, o, os, progress);
+
+        lock.lock();
+        Building.erase(target);
+        return error;
+    }
+
+    int id = Jobs.empty() ? 1 : Jobs.rbegin()->first + 1;
+    Job* job = (Jobs[id] = std::unique_ptr<Job>(new Job())).get();
+
+    job->pgnName = bookName;
+    job->target = target;
+    job->progress.log = &job->nullLog;
+    job->start = now();
+
+    if (follow)
+    {
+        job->follow = true;
+        job->progress.stage = FOLLOWING;
+        job->th = std::thread(::follow, job);
+        os << "{\n    \"Job\": " << id << "\n}" << std::endl;
+        return "";
+    }
+
+    job->th = std::thread([=]{
+        std::stringstream ss;
+        job->error = build_book(bookName, o, ss, job->progress);
+        job->output = ss.str();
+        job->elapsed = now() - job->start;
+        job->progress.stage = job->error.empty() ? DONE : FAILED;
+    });
+
+    os << "{\n    \"Job\": " << id << "\n}" << std::endl;
+    return "";
+}
+
+
+/// status() reports the progress of a book build started with "async", or of
+/// all of them when no job id is given. While parsing, the ETA extrapolates the
+/// parsing speed so far to the rest of the file.
+
+std::string status(std::istringstream& is, std::ostream& os) {
+
+    int id = 0;
+    is >> id;
+
+    std::lock_guard<std::mutex> lock(JobsMutex);
+
+    if (id && !Jobs.count(id))
+        return "Unknown job " + std::to_string(id);
+
+    std::string tab = "\n    ";
+    std::string comma;
+    std::stringstream json;
+
+    if (!id)
+        json << "[\n";
+
+    for (auto& j : Jobs)
+    {
+        if (id && j.first != id)
+            continue;
+
+        const Job& job = *j.second;
+        const Progress& p = job.progress;
+        int stage = p.stage;
+        uint64_t bytes = p.bytes, size = p.size;
+        TimePoint elapsed = stage >= DONE ? job.elapsed : now() - job.start;
+
+        json << comma << "{"
+             << tab << "\"Job\": " << j.first << ","
+             << tab << "\"PGN file\": " << json_string(job.pgnName) << ","
+             << tab << "\"Stage\": \"" << StageNames[stage] << "\","
+             << tab << "\"Bytes parsed\": " << bytes << ","
+             << tab << "\"Bytes total\": " << size << ","
+             << tab << "\"Games\": " << p.games << ","
+             << tab << "\"Elapsed (ms)\": " << elapsed << ","
+             << tab << "\"ETA (ms)\": ";
+
+        if (stage >= DONE)
+            json << 0;
+        else if (stage == PARSING && bytes)
+            json << elapsed * (size - bytes) / bytes;
+        else
+            json << "null";
+
+        if (job.follow)
+            json << "," << tab << "\"Lag (ms)\": " << job.lag;
+
+        if (stage == DONE)
+        {
+            std::string result = job.output.substr(0, job.output.find_last_not_of("\n") + 1);
+            for (size_t i = 0; (i = result.find('\n', i)) != std::string::npos; i += tab.size())
+                result.replace(i, 1, tab);
+
+            json << "," << tab << "\"Result\": " << result;
+        }
+        else if (stage == FAILED)
+            json << "," << tab << "\"Error\": " << json_string(job.error);
+
+        json << "\n}";
+        comma = ",\n";
+    }
+
+    if (!id)
+        json << "\n]";
+
+    os << json.str() << std::endl;
+    return "";
+}
+
+
+std::string make_hash(std::istringstream& is, std::ostream& os) {
+
+    std::string bookName;
+    is >> bookName;
+
+    if (bookName.empty())
+        return "Missing book file name...";
+
+    std::ifstream ifs(bookName, std::ifstream::in | std::ifstream::binary);
+
+    if (!ifs.is_open())
+        return "Could not open " + bookName;
+
+    ifs.seekg(0, std::ios::end);
+    uint64_t bookSize = ifs.tellg(), bookTime = file_time(bookName);
+    ifs.seekg(0, std::ios::beg);
+
+    // Collect unique keys together with the index of their first entry
+    std::vector<Key> keys;
+    std::vector<uint64_t> firsts;
+    PolyEntry e;
+
+    for (uint64_t idx = 0; idx < bookSize / SizeOfPolyEntry; ++idx)
+    {
+        read_entry(e, ifs);
+        if (keys.empty() || e.key != keys.back())
+        {
+            keys.push_back(e.key);
+            firsts.push_back(idx);
+        }
+    }
+
+    ifs.close();
+
+    std::string hashName = MinimalPerfectHash::sidecar(bookName);
+
+    TimePoint elapsed = now();
+
+    size_t hashSize = MinimalPerfectHash::build(keys, firsts, bookSize, bookTime, hashName);
+
+    elapsed = now() - elapsed;
+
+    MinimalPerfectHash mph;
+    if (!mph.open(hashName, bookSize, bookTime))
+        return "Could not open " + hashName;
+
+    // Benchmark lookups in random order, both of keys in the book and of random
+    // keys that are not, against a binary search over the sorted keys.
+    PRNG rng(1070372);
+    std::vector<Key> shuffled = keys, absent(keys.size());
+
+    for (size_t i = shuffled.size(); i > 1; --i)
+        std::swap(shuffled[i - 1], shuffled[rng.rand<uint64_t>() % i]);
+
+    for (Key& k : absent)
+        k = rng.rand<Key>();
+
+    size_t falsePositives = 0;
+    for (Key k : absent)
+    {
+        bool found;
+        mph.probe(k, &found);
+        falsePositives += found && !std::binary_search(keys.begin(), keys.end(), k);
+    }
+
+    double hashNs = ns_per_probe(shuffled, [&](Key k) {
+        bool found;
+        return mph.probe(k, &found);
+    });
+
+    double hashMissNs = ns_per_probe(absent, [&](Key k) {
+        bool found;
+        return mph.probe(k, &found) + found;
+    });
+
+    double searchNs = ns_per_probe(shuffled, [&](Key k) {
+        return uint64_t(std::lower_bound(keys.begin(), keys.end(), k) - keys.begin());
+    });
+
+    size_t n = std::max(keys.size(), size_t(1));
+
+    // Output benchmark info in JSON format
+    std::string tab = "\n    ";
+    std::stringstream json;
+    json << "{"
+         << tab << "\"Unique positions\": " << keys.size() << ","
+         << tab << "\"Build time (ms)\": " << elapsed << ","
+         << tab << "\"Size of hash file (bytes)\": " << hashSize << ","
+         << tab << "\"Hash bits/key\": " << double(mph.hash_bits()) / n << ","
+         << tab << "\"Total bits/key\": " << 8.0 * hashSize / n << ","
+         << tab << "\"Hash lookup (ns)\": " << hashNs << ","
+         << tab << "\"Hash miss lookup (ns)\": " << hashMissNs << ","
+         << tab << "\"Binary search lookup (ns)\": " << searchNs << ","
+         << tab << "\"False positives (%)\": " << 100.0 * falsePositives / n << ","
+         << tab << "\"Hash file\": \"" << hashName << "\"\n"
+         << "}";
+
+    os << json.str() << std::endl;
+    return "";
+}
+
+
+/// merge() merges books into a new one with merge_books(), without parsing any
+/// PGN. Game offsets of each book are moved past those of the previous ones,
+/// and the sources sidecar of the new book records where each range comes
+/// from. Books must be full ones. Memory does not depend on the size of the
+/// books.
+
+std::string merge(std::istringstream& is, std::ostream& os) {
+
+    std::string bookName, token;
+    std::vector<std::string> names;
+    bool full = false;
+
+    is >> bookName;
+
+    while (is >> token)
+        if (token == "full")
+            full = true;
+        else
+            names.push_back(token);
+
+    if (bookName.empty() || names.empty())
+        return "Missing book file names...";
+
+    TimePoint elapsed = now();
+
+    std::vector<std::unique_ptr<MappedBook>> books;
+    std::vector<uint32_t> bases; // First game offset of each book, divided by 8
+    std::vector<Source> sources;
+    uint64_t base = 0;
+
+    for (const std::string& name : names)
+    {
+        if (name == bookName)
+            return "Cannot merge " + name + " into itself";
+
+        books.emplace_back(new MappedBook());
+        if (!books.back()->open(name))
+            return "Could not open " + name;
+
+        // Weights of a book that is not full cannot be added up with others
+        if (!is_full_book(*books.back(), name))
+            return "Not a full book: " + name + ", build it with \"full\" to merge it";
+
+        const MappedBook& book = *books.back();
+        std::vector<Source> nested;
+        uint64_t span = 0;
+
+        // Sources of a merged book are kept, so that they never nest
+        if (read_sources(sources_name(name), nested))
+        {
+            for (const Source& src : nested)
+                sources.push_back({ base + src.base, src.size, src.pgn });
+
+            span = nested.back().base + nested.back().size;
+        }
+        else
+        {
+            std::string pgn = name.substr(0, name.find_last_of(".")) + ".pgn";
+
+            // Without its PGN, the book spans up to its last game offset
+            if (!(span = file_size(pgn)))
+                for (size_t idx = 0; idx < book.size(); ++idx)
+                    span = std::max(span, uint64_t((book[idx].learn & 0x3FFFFFFF) + 1) << 3);
+
+            sources.push_back({ base, span, pgn });
+        }
+
+        bases.push_back(uint32_t(base >> 3));
+        base += (span + 7) & ~uint64_t(7);
+
+        if (base > (uint64_t(0x3FFFFFFF) << 3))
+            return "Merged games exceed the game offset range of a book";
+    }
+
+    // Written aside and renamed over a previous book, as build_book() does
+    std::string tmpName = bookName + ".tmp";
+    std::ofstream ofs(tmpName, std::ofstream::out | std::ofstream::binary);
+    if (!ofs.is_open())
+        return "Could not open " + tmpName;
+
+    std::vector<const MappedBook*> inputs;
+    for (auto& b : books)
+        inputs.push_back(b.get());
+
+    uint64_t uniqueKeys = merge_books(inputs, bases, full, ofs);
+    size_t bookSize = ofs.tellp();
+    ofs.close();
+
+    // Sidecars of a previous book would point to wrong entries of the new one
+    std::remove(MinimalPerfectHash::sidecar(bookName).c_str());
+    std::remove(BloomFilter::sidecar(bookName).c_str());
+    std::remove(HotTable::sidecar(bookName).c_str());
+
+    if (!replace_file(tmpName, bookName))
+        return "Could not write " + bookName;
+
+    write_length(bookName, bookSize, full);
+
+    std::string sourcesName = sources_name(bookName);
+    std::ofstream src(sourcesName);
+    for (const Source& s : sources)
+        src << s.base << " " << s.size << " " << s.pgn << "\n";
+
+    elapsed = now() - elapsed;
+
+    std::string tab = "\n    ";
+    std::stringstream json;
+    json << "{"
+         << tab << "\"Books merged\": " << books.size() << ","
+         << tab << "\"Entries\": " << bookSize / SizeOfPolyEntry << ","
+         << tab << "\"Unique positions\": " << uniqueKeys << ","
+         << tab << "\"Size of index file (bytes)\": " << bookSize << ","
+         << tab << "\"Book file\": " << json_string(bookName) << ","
+         << tab << "\"Sources file\": " << json_string(sourcesName) << ","
+         << tab << "\"Processing time (ms)\": " << elapsed << "\n"
+         << "}";
+
+    os << json.str() << std::endl;
+    return "";
+}
+
+
+/// reduce() merges the runs written by "book <pgn> range S E" over the ranges
+/// of a PGN into the book a single build of the whole PGN writes, a full one
+/// with "full", and pruned of the moves of less than K games with "mingames K".
+/// Unlike merge, game offsets are kept as they are, all the runs indexing the
+/// same PGN: "reduce <book file> <run file>... [full] [mingames K]"
+
+std::string reduce(std::istringstream& is, std::ostream& os) {
+
+    std::string bookName, token;
+    std::vector<std::string> names;
+    bool full = false;
+    size_t minGames = 0;
+
+    is >> bookName;
+
+    while (is >> token)
+        if (token == "full")
+            full = true;
+        else if (token == "mingames")
+        {
+            if (!(is >> minGames) || !minGames)
+                return "mingames needs the number of games a move is kept from";
+        }
+        else
+            names.push_back(token);
+
+    if (bookName.empty() || names.empty())
+        return "Missing book file names...";
+
+    TimePoint elapsed = now();
+
+    std::vector<std::unique_ptr<MappedBook>> runs;
+    std::vector<const MappedBook*> inputs;
+
+    for (const std::string& name : names)
+    {
+        runs.emplace_back(new MappedBook());
+        if (name == bookName || !runs.back()->open(name))
+            return "Could not open run " + name;
+
+        inputs.push_back(runs.back().get());
+    }
+
+    std::string tmpName = bookName + ".tmp";
+    std::ofstream ofs(tmpName, std::ofstream::out | std::ofstream::binary);
+    if (!ofs.is_open())
+        return "Could not open " + tmpName;
+
+    uint64_t uniqueKeys = merge_books(inputs, std::vector<uint32_t>(inputs.size(), 0), full, ofs, minGames);
+    size_t bookSize = ofs.tellp();
+    ofs.close();
+
+    std::remove(MinimalPerfectHash::sidecar(bookName).c_str());
+    std::remove(BloomFilter::sidecar(bookName).c_str());
+    std::remove(HotTable::sidecar(bookName).c_str());
+    std::remove(sources_name(bookName).c_str());
+
+    if (!replace_file(tmpName, bookName))
+        return "Could not write " + bookName;
+
+    write_length(bookName, bookSize, full);
+
+    elapsed = now() - elapsed;
+
+    std::string tab = "\n    ";
+    std::stringstream json;
+    json << "{"
+         << tab << "\"Runs merged\": " << runs.size() << ","
+         << tab << "\"Entries\": " << bookSize / SizeOfPolyEntry << ","
+         << tab << "\"Unique positions\": " << uniqueKeys << ","
+         << tab << "\"Size of index file (bytes)\": " << bookSize << ","
+         << tab << "\"Book file\": " << json_string(bookName) << ","
+         << tab << "\"Processing time (ms)\": " << elapsed << "\n"
+         << "}";
+
+    os << json.str() << std::endl;
+    return "";
+}
+
+
+/// ingest() indexes the games added to a PGN file since the last call into its
+/// live index, see ingest_pgn(). With "flush N" the delta is written to a run
+/// every N entries.
+
+std::string ingest(std::istringstream& is, std::ostream& os) {
+
+    std::string pgnName, token;
+    size_t flushEntries = 0;
+
+    is >> pgnName;
+
+    if (pgnName.empty())
+        return "Missing PGN file name...";
+
+    while (is >> token)
+        if (token == "flush" && (!(is >> flushEntries) || !flushEntries))
+            return "flush needs a number of entries";
+
+    Progress progress = {};
+    progress.log = &std::cerr;
+    return ingest_pgn(pgnName, flushEntries, os, progress);
+}
+
+
+/// partition_point() returns the first index in [low, high) of an entry not
+/// satisfying 'pred', assuming all the entries that satisfy it come first. It
+/// gallops from 'low', so the cost is logarithmic in the distance found.
+
+template<typename EntryAt, typename Pred>
+size_t partition_point(EntryAt& at, size_t low, size_t high, Pred pred) {
+
+    size_t end = low, step = 1;
+
+    while (end < high && pred(at(end)))
+    {
+        low = end + 1;
+        end += step;
+        step *= 2;
+    }
+
+    for (end = std::min(end, high); low < end; )
+    {
+        size_t mid = (low + end) / 2;
+
+        if (pred(at(mid)))
+            low = mid + 1;
+        else
+            end = mid;
+    }
+
+    return low;
+}
+
+/// move_json() formats a move of a position with its statistics and a page of
+/// its game offsets. Offsets of a query over several books are tagged with
+/// their book, when 'books' is given.
+
+std::string move_json(const MoveStats& m, const std::vector<std::string>& books = {}) {
+
+    // Note that this output will only make sense if the parser is run in full mode,
+    // if not, there will always be one game, one win, and 0 draws and 0 losses.
+    std::string str =  "\"move\": \"" + UCI::move(Move(m.move), false) + "\""
+                     + ", \"weight\": " + std::to_string(m.weight)
+                     + ", \"games\": "  + std::to_string(m.games)
+                     + ", \"wins\": "   + std::to_string(m.wins)
+                     + ", \"losses\": " + std::to_string(m.losses)
+                     + ", \"draws\": "  + std::to_string(m.draws)
+                     + ", \"pgn offsets\": [";
+
+    std::string comma;
+    for (size_t i = 0; i < m.offsets.size(); ++i)
+    {
+        std::string ofs = std::to_string(uint64_t(m.offsets[i] & 0x3FFFFFFF) << 3);
+
+        if (books.empty())
+            str += comma + ofs;
+        else
+            str += comma + "{\"book\": " + json_string(books[m.books[i]]) + ", \"offset\": " + ofs + "}";
+
+        comma = ", ";
+    }
+
+    return str + "]";
+}
+
+/// probe_key() collects the moves, with their statistics and game offsets, of
+/// the position whose first entry is at index 'first' among the 'size' ones
+/// returned by 'at'. Posting lists are sorted by result, then by game offset,
+/// so result counts are found by binary search and a page of game offsets is
+/// a direct jump. Results of books with unsorted posting lists are counted
+/// one entry at a time instead. Returns true if some move has more game
+/// offsets after this page.
+
+template<typename EntryAt>
+bool probe_key(std::vector<MoveStats>& moves, EntryAt at, size_t size,
+               size_t first, size_t limit, size_t skip, bool sorted = true) {
+
+    const Key key = at(first).key;
+    bool more = false;
+
+    for (size_t idx = first, end; idx < size && at(idx).key == key; idx = end)
+    {
+        PolyEntry e = at(idx);
+        PMove move = e.move;
+
+        end = partition_point(at, idx, size, [&](const PolyEntry& x) {
+            return x.key == key && x.move == move;
+        });
+
+        // Results are coded in the upper 2 bits of 'learn'
+        size_t counts[4] = {};
+        if (sorted)
+        {
+            size_t bounds[4] = { idx, idx, idx, idx };
+            for (uint32_t r = 1; r < 4; ++r)
+            {
+                bounds[r] = partition_point(at, bounds[r - 1], end, [&](const PolyEntry& x) {
+                    return (x.learn >> 30) < r;
+                });
+                counts[r - 1] = bounds[r] - bounds[r - 1];
+            }
+        }
+        else
+            for (size_t i = idx; i < end; ++i)
+                counts[at(i).learn >> 30]++;
+
+        MoveStats m = { e.move, e.weight, end - idx, counts[0], counts[1], counts[2], {}, {} };
+
+        for (size_t i = idx + std::min(skip, end - idx); i < end && i < idx + skip + limit; ++i)
+            m.offsets.push_back(at(i).learn);
+
+        moves.push_back(m);
+        more |= end - idx > skip + limit;
+    }
+
+    return more;
+}
+
+bool probe_key(std::vector<MoveStats>& moves, const MappedBook& book,
+               size_t idx, size_t limit, size_t skip) {
+
+    auto at = [&](size_t i) { return book[i]; };
+    return probe_key(moves, at, book.size(), idx, limit, skip, book.sorted_postings());
+}
+
+bool probe_key(std::vector<std::string>& json_moves, const MappedBook& book,
+               size_t idx, size_t limit, size_t skip) {
+
+    std::vector<MoveStats> moves;
+    bool more = probe_key(moves, book, idx, limit, skip);
+
+    for (const MoveStats& m : moves)
+        json_moves.push_back(move_json(m));
+
+    return more;
+}
+
+/// hot_position() returns the hot position with the given key when the page
+/// requested of every move is among the stored game offsets, else nullptr.
+
+const HotTable::Position* hot_position(const MappedBook& book, Key key, size_t limit, size_t skip) {
+
+    const HotTable& hot = book.hot_table();
+    const HotTable::Position* pos = hot.probe(key);
+
+    if (!pos)
+        return nullptr;
+
+    const HotTable::Move* moves = hot.moves(*pos);
+
+    for (size_t i = 0; i < pos->moves; ++i)
+        if (std::min(size_t(moves[i].games), skip + limit) > hot.stored(moves[i]))
+            return nullptr;
+
+    return pos;
+}
+
+/// probe_hot() answers a query out of the hot table of the book, when
+/// hot_position() finds the key there. Returns false if the book must be
+/// probed instead.
+
+bool probe_hot(std::vector<std::string>& json_moves, bool& more, const MappedBook& book,
+               Key key, size_t limit, size_t skip) {
+
+    const HotTable& hot = book.hot_table();
+    const HotTable::Position* pos = hot_position(book, key, limit, skip);
+
+    if (!pos)
+        return false;
+
+    const HotTable::Move* moves = hot.moves(*pos);
+    more = false;
+
+    for (size_t i = 0; i < pos->moves; ++i)
+    {
+        const HotTable::Move& m = moves[i];
+        const uint32_t* ofs = hot.offsets(m);
+        size_t from = std::min(skip, size_t(m.games)), to = std::min(skip + limit, size_t(m.games));
+
+        json_moves.push_back(move_json({ m.move, m.weight, m.games, m.wins, m.losses, m.draws,
+                                         std::vector<uint32_t>(ofs + from, ofs + to), {} }));
+        more |= m.games > skip + limit;
+    }
+
+    HotHits++;
+    return true;
+}
+
+/// hot_results() adds up the results of all the games that reached the given
+/// position, like count_results(), when it is one of the hot positions.
+
+bool hot_results(const MappedBook& book, Key key, uint64_t results[4]) {
+
+    const HotTable& hot = book.hot_table();
+    const HotTable::Position* pos = hot.probe(key);
+
+    if (!pos)
+        return false;
+
+    const HotTable::Move* moves = hot.moves(*pos);
+
+    for (size_t i = 0; i < pos->moves; ++i)
+    {
+        results[0] += moves[i].wins;
+        results[1] += moves[i].losses;
+        results[2] += moves[i].draws;
+        results[3] += moves[i].games - moves[i].wins - moves[i].losses - moves[i].draws;
+    }
+
+    HotHits++;
+    return true;
+}
+
+/// merge_moves() merges the moves of a position found in several sources, as
+/// they would be in a book built out of all their games at once: statistics
+/// are summed, weights recomputed as sort_by_frequency() does and moves sorted
+/// the same way. The games of a move are those of each source in turn, tagged
+/// with their source.
+
+std::vector<MoveStats> merge_moves(const std::vector<std::vector<MoveStats>>& found) {
+
+    std::vector<MoveStats> moves;
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < found.size(); ++i)
+        for (const MoveStats& f : found[i])
+        {
+            auto it = std::find_if(moves.begin(), moves.end(), [&](const MoveStats& m) {
+                return m.move == f.move;
+            });
+
+            if (it == moves.end())
+                it = moves.insert(moves.end(), { f.move, 0, 0, 0, 0, 0, {}, {} });
+
+            it->games += f.games;
+            it->wins += f.wins;
+            it->losses += f.losses;
+            it->draws += f.draws;
+            it->offsets.insert(it->offsets.end(), f.offsets.begin(), f.offsets.end());
+            it->books.insert(it->books.end(), f.offsets.size(), i);
+            total += f.games;
+        }
+
+    for (MoveStats& m : moves)
+        m.weight = uint16_t(total > 2 ? m.games * 0xFFFF / total : 1);
+
+    std::sort(moves.begin(), moves.end(), [](const MoveStats& a, const MoveStats& b) {
+        return a.weight > b.weight || (a.weight == b.weight && a.move > b.move);
+    });
+
+    return moves;
+}
+
+/// find_books() answers a find over several books. They are probed in parallel
+/// and the moves merged, the requested page of game offsets is taken out of
+/// those of each book in turn.
+
+std::string find_books(const std::vector<std::string>& books, const std::string& fen,
+                       Key key, size_t limit, size_t skip, std::ostream& os) {
+
+    std::vector<std::vector<MoveStats>> found(books.size());
+    std::vector<std::shared_ptr<const MappedBook>> mapped(books.size());
+
+    for (size_t i = 0; i < books.size(); ++i)
+        if (!(mapped[i] = Books::open(books[i])))
+            return "Could not map " + books[i];
 
-    elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+    parallel_for(books.size(), [&](size_t i) {
+        const std::shared_ptr<const MappedBook>& book = mapped[i];
+        size_t idx = book->find(key);
 
-    unmap(baseAddress, mapping);
+        if (idx != book->size())
+            probe_key(found[i], *book, idx, skip + limit, 0);
+    });
 
-    std::cerr << "done\nSorting...";
+    std::vector<MoveStats> moves = merge_moves(found);
+    std::vector<std::string> json_moves;
+    bool more = false;
 
-    std::sort(kTable.begin(), kTable.end());
+    for (MoveStats& m : moves)
+    {
+        size_t from = std::min(skip, m.offsets.size());
+        size_t to = std::min(skip + limit, m.offsets.size());
 
-    size_t uniqueKeys = 1, last = 0;
-    for (size_t idx = 1; idx < kTable.size(); ++idx)
-        if (kTable[idx].key != kTable[idx - 1].key)
-        {
-            if (idx - last > 2)
-                idx = sort_by_frequency(kTable, last, idx);
+        m.offsets = std::vector<uint32_t>(m.offsets.begin() + from, m.offsets.begin() + to);
+        m.books = std::vector<size_t>(m.books.begin() + from, m.books.begin() + to);
+        json_moves.push_back(move_json(m, books));
+        more |= m.games > skip + limit;
+    }
 
-            last = idx;
-            uniqueKeys++;
-        }
+    std::string cursor;
+    if (more)
+        cursor = ",\n    \"cursor\": \"" + make_cursor(key, skip + limit) + "\"";
 
-    std::cerr << "done\nWriting Polygot book...";
+    os << position_json(fen, key, json_moves, cursor) << std::endl;
+    return "";
+}
 
-    size_t lastdot = bookName.find_last_of(".");
-    if (lastdot != std::string::npos)
-        bookName = bookName.substr(0, lastdot);
-    bookName += ".bin";
-    size_t bookSize = write_poly_file(kTable, bookName, full);
+/// probe_live() answers a find on a live index, out of its book, its runs and
+/// its delta. Games of a move are in the same order as in a book rebuilt out of
+/// the whole PGN file, so pages are the same. Returns true if some move has
+/// more games after this page.
 
-    std::cerr << "done\n" << std::endl;
+bool probe_live(std::vector<std::string>& json_moves, const LiveSnapshot& snap,
+                Key key, size_t limit, size_t skip) {
 
-    // Output probing info in JSON format
-    std::string tab = "\n    ";
-    std::stringstream json;
-    json << "{"
-         << tab << "\"Games\": " << stats.games << ","
-         << tab << "\"Moves\": " << stats.moves << ","
-         << tab << "\"Incorrect moves\": " << stats.fixed << ","
-         << tab << "\"Unique positions (%)\": " << (stats.moves ? 100 * uniqueKeys / stats.moves : 0) << ","
-         << tab << "\"Games/second\": " << 1000 * stats.games / elapsed << ","
-         << tab << "\"Moves/second\": " << 1000 * stats.moves / elapsed << ","
-         << tab << "\"MBytes/second\": " << float(size) / elapsed / 1000 << ","
-         << tab << "\"Size of index file (bytes)\": " << bookSize << ","
-         << tab << "\"Book file\": \"" << bookName << "\","
-         << tab << "\"Processing time (ms)\": " << elapsed << "\n"
-         << "}";
+    std::vector<const MappedBook*> books = { snap.book.get() };
+    for (const auto& run : snap.runs)
+        books.push_back(run.get());
 
-    std::cout << json.str() << std::endl;
-}
+    std::vector<std::vector<MoveStats>> found(books.size() + 1);
 
+    for (size_t i = 0; i < books.size(); ++i)
+    {
+        size_t idx = books[i]->find(key);
 
-void probe_key(std::vector<std::string>& json_moves, const std::string& fName,
-               size_t ofs, size_t limit, size_t skip) {
+        if (idx != books[i]->size())
+            probe_key(found[i], *books[i], idx, skip + limit, 0);
+    }
 
-    std::ifstream ifs(fName.c_str(), std::ifstream::in | std::ifstream::binary);
+    const Keys& delta = *snap.delta;
+    auto it = std::lower_bound(delta.begin(), delta.end(), key, [](const PolyEntry& e, Key k) {
+        return e.key < k;
+    });
 
-    if (!ifs.is_open())
-        return;
+    if (it != delta.end() && it->key == key)
+    {
+        auto at = [&](size_t i) { return delta[i]; };
+        probe_key(found.back(), at, delta.size(), it - delta.begin(), skip + limit, 0);
+    }
 
-    ifs.seekg(ofs, std::ios_base::beg);
+    bool more = false;
 
-    PolyEntry e;
-    read_entry(e, ifs);
-    Key key = e.key;
-    std::vector<uint64_t> pgn_ofs;
-    pgn_ofs.reserve(limit);
+    for (MoveStats& m : merge_moves(found))
+    {
+        // By result, then by game offset, as a posting list
+        std::sort(m.offsets.begin(), m.offsets.end());
 
-    do {
-        PMove move = e.move;
-        std::string str("\"move\": \"" + UCI::move(Move(e.move), false) + "\", \"weight\": ");
-        str += std::to_string(e.weight);
-        uint64_t results[4] = {};
-        size_t skip_counter = skip;
+        size_t from = std::min(skip, m.offsets.size());
+        size_t to = std::min(skip + limit, m.offsets.size());
+
+        m.offsets = std::vector<uint32_t>(m.offsets.begin() + from, m.offsets.begin() + to);
+        json_moves.push_back(move_json(m));
+        more |= m.games > skip + limit;
+    }
 
-        do {
-            if (!skip_counter && pgn_ofs.size() < limit)
-                pgn_ofs.push_back((e.learn & 0x3FFFFFFF) << 3);
+    return more;
+}
 
-            if (skip_counter)
-                --skip_counter;
+/// find() and the other query commands below write their result to 'os' and
+/// return an error message, empty on success, so that they can also be run on
+/// behalf of a client of the server, on any thread.
 
-            results[(e.learn >> 30) & 3]++;
-            read_entry(e, ifs);
-        }
-        while (e.move == move);
+std::string find(std::istringstream& is, std::ostream& os) {
 
-        // Note that this output will only make sense if the parser is run in full mode,
-        // if not, there will always be one game, one win, and 0 draws and 0 losses.
-        str +=  ", \"games\": "  + std::to_string(results[0] + results[1] + results[2] + results[3])
-              + ", \"wins\": "   + std::to_string(results[0])
-              + ", \"losses\": " + std::to_string(results[1])
-              + ", \"draws\": "  + std::to_string(results[2])
-              + ", \"pgn offsets\": [";
+    std::string bookName, token, fenStr, fen;
+    size_t limit = 10, skip = 0;
+    bool resume = false;
+    Key key = 0;
+    is >> bookName;
 
-        for (auto v : pgn_ofs)
-            str += std::to_string(v) + ", ";
+    if (bookName.empty())
+        return "Missing PGN file name...";
 
-        if (str[str.length() - 1] == ' ')
+    while (is >> token)
+        if (token == "cursor")
         {
-            str.pop_back();
-            str.pop_back();
+            is >> token;
+            if (!(resume = read_cursor(token, key, skip)))
+                return "Invalid cursor " + token;
         }
+        else if (!read_limits(is, token, limit, skip))
+            fenStr += token + " ";
+
+    if (limit < 1)
+        return "limit must be greater than 1";
 
-        pgn_ofs.clear();
+    if (fenStr.empty() && !resume)
+        return "Missing FEN string...";
+
+    // A cursor already knows the position key, the FEN is not needed
+    if (!resume)
+    {
+        StateInfo st;
+        Position pos;
+        pos.set(fenStr, false, &st);
+        fen = pos.fen();
+        key = pos.key();
+    }
 
-        str += "]";
+    // A list of books, or a manifest, is searched as a single book. A sharded
+    // book is searched in the shard of the key only.
+    if (   bookName.find(',') != std::string::npos
+        || bookName.size() < 4 || bookName.compare(bookName.size() - 4, 4, ".bin"))
+    {
+        std::vector<std::string> books;
+        std::string error = book_list(bookName, books);
+        int bits = bookName.find(',') == std::string::npos ? shard_bits(bookName) : 0;
 
-        json_moves.push_back(str);
+        if (!error.empty())
+            return error;
 
-    } while (key == e.key);
+        if (!bits || books.size() != size_t(1) << bits)
+            return find_books(books, fen, key, limit, skip, os);
 
-    ifs.close();
+        bookName = books[shard_of(key, bits)];
+    }
+
+    // A rebuilt book gets a new mapping id, so stale results are never hit. The
+    // same for a live index, whose snapshot ids are kept apart from mapping ids.
+    std::shared_ptr<const LiveSnapshot> live = live_snapshot(bookName);
+    std::shared_ptr<const MappedBook> book = live ? live->book : Books::open(bookName);
+
+    if (!book)
+        return "Could not map " + bookName;
+
+    FindKey ck = { live ? live->id | (1ULL << 63) : book->id(), key, limit, skip };
+    FindResult r;
+
+    // Hot positions are answered as fast as from the cache, without filling it
+    if (   (live || !probe_hot(r.moves, r.more, *book, key, limit, skip))
+        && !FindCache.get(ck, r))
+    {
+        if (live)
+            r.more = probe_live(r.moves, *live, key, limit, skip);
+        else
+        {
+            size_t idx = book->find(key);
+            r.more = idx != book->size() && probe_key(r.moves, *book, idx, limit, skip);
+        }
+
+        FindCache.put(ck, r);
+    }
+
+    // When there are more games, add a cursor to get the next page
+    std::string cursor;
+    if (r.more)
+        cursor = ",\n    \"cursor\": \"" + make_cursor(key, skip + limit) + "\"";
+
+    os << position_json(fen, key, r.moves, cursor) << std::endl;
+    return "";
 }
 
-void find(std::istringstream& is) {
+/// prefetch() fills the cache with the first page of the children reached by
+/// the most played book moves of a position, as a client browsing the book is
+/// likely to ask for one of them next. Run by the server in the background,
+/// after answering a query on the position. Only plain books are prefetched.
+
+std::string prefetch(std::istringstream& is, std::ostream& os) {
 
-    PolyglotBook book;
     std::string bookName, token, fenStr;
-    size_t limit = 10, skip = 0;
+    size_t limit = 10, skip = 0, count = 3;
     is >> bookName;
 
     if (bookName.empty())
+        return "Missing book file name...";
+
+    while (is >> token)
+        if (token == "moves")
+            is >> count;
+        else if (!read_limits(is, token, limit, skip))
+            fenStr += token + " ";
+
+    if (limit < 1)
+        return "limit must be greater than 1";
+
+    if (fenStr.empty())
+        return "Missing FEN string...";
+
+    // Lists of books and live indexes are cached by find() under other keys,
+    // so only plain and sharded books are worth prefetching.
+    ShardedBook books;
+
+    if (live_snapshot(bookName) || !open_sharded(bookName, books).empty())
     {
-        std::cerr << "Missing PGN file name..." << std::endl;
-        exit(0);
+        os << "{\n    \"Prefetched\": 0\n}" << std::endl;
+        return "";
     }
 
-    while (is >> token)
-        if (token == "limit")
+    StateInfo st, childSt;
+    Position pos;
+    pos.set(fenStr, false, &st);
+
+    // Entries of a position are sorted by weight, so the first moves found are
+    // the most played ones.
+    std::vector<PMove> bookMoves;
+    const MappedBook* book = &books.of(pos.key());
+    auto at = [&](size_t i) { return (*book)[i]; };
+
+    for (size_t idx = book->find(pos.key()); idx < book->size() && bookMoves.size() < count; )
+    {
+        PolyEntry e = at(idx);
+
+        if (e.key != pos.key())
+            break;
+
+        bookMoves.push_back(e.move);
+        idx = partition_point(at, idx, book->size(), [&](const PolyEntry& x) {
+            return x.key == e.key && x.move == e.move;
+        });
+    }
+
+    size_t prefetched = 0;
+
+    for (const auto& m : MoveList<LEGAL>(pos))
+    {
+        if (std::find(bookMoves.begin(), bookMoves.end(), to_polyglot(m)) == bookMoves.end())
+            continue;
+
+        Position child = pos;
+        child.do_move(m, childSt, pos.gives_check(m));
+
+        // A click on a child starts from its first page
+        book = &books.of(child.key());
+        FindKey ck = { book->id(), child.key(), limit, 0 };
+
+        if (hot_position(*book, ck.key, limit, 0) || FindCache.contains(ck))
+            continue;
+
+        FindResult r;
+        size_t idx = book->find(ck.key);
+
+        r.more = idx != book->size() && probe_key(r.moves, *book, idx, limit, 0);
+        FindCache.put(ck, r);
+        prefetched++;
+    }
+
+    Prefetches += prefetched;
+
+    os << "{\n    \"Prefetched\": " << prefetched << "\n}" << std::endl;
+    return "";
+}
+
+std::string find_batch(std::istringstream& is, std::ostream& os) {
+
+    const size_t ChunkSize = 16384;
+
+    std::string bookName, token, fileName, line;
+    std::ifstream ifs;
+    size_t limit = 10, skip = 0;
+
+    std::getline(is, line);
+    std::istringstream args(line);
+    args >> bookName;
+
+    if (bookName.empty())
+        return "Missing book file name...";
+
+    while (args >> token)
+        if (!read_limits(args, token, limit, skip))
+            fileName = token;
+
+    if (limit < 1)
+        return "limit must be greater than 1";
+
+    if (!fileName.empty())
+    {
+        ifs.open(fileName);
+        if (!ifs.is_open())
+            return "Could not open " + fileName;
+    }
+
+    // Queries are read one per line, either a FEN or a book key, until EOF or
+    // an "end" line, so that a batch can also be sent through an open pipe. They
+    // come from the file, else from the lines following the command, else stdin.
+    std::istream& in = !fileName.empty() ? ifs : is.peek() != EOF ? is : std::cin;
+
+    ShardedBook book;
+    std::string error = open_sharded(bookName, book);
+
+    if (!error.empty())
+        return error;
+
+    std::vector<std::string> fens;
+    std::vector<Key> keys;
+    std::vector<std::string> results;
+    std::string comma = "\n";
+    bool more = true;
+
+    os << "[";
+
+    // Queries are answered in chunks, so that memory stays bounded and results
+    // are streamed while the rest of the input is still being read.
+    while (more)
+    {
+        fens.clear();
+        keys.clear();
+
+        while (fens.size() < ChunkSize)
         {
-            is >> token;
-            std::stringstream to_size_t(token);
-            to_size_t >> limit;
-            if (limit < 1)
+            if (!std::getline(in, line) || line.compare(0, 3, "end") == 0)
+            {
+                more = false;
+                break;
+            }
+
+            size_t first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos)
+                continue;
+
+            size_t last = line.find_last_not_of(" \t\r");
+            line = line.substr(first, last - first + 1);
+
+            // A key is either decimal or hex with a 0x prefix, anything else is a
+            // FEN, so that a leading zero is never taken for octal.
+            bool hex =    line.size() > 2 && line.size() <= 18 && line[0] == '0'
+                       && (line[1] == 'x' || line[1] == 'X')
+                       && line.find_first_not_of("0123456789abcdefABCDEF", 2) == std::string::npos;
+
+            if (hex || line.find_first_not_of("0123456789") == std::string::npos)
+            {
+                fens.push_back("");
+                keys.push_back(std::strtoull(line.c_str() + 2 * hex, nullptr, hex ? 16 : 10));
+            }
+            else
             {
-                std::cerr << "limit must be greater than 1" << std::endl;
-                exit(0);
+                StateInfo st;
+                Position pos;
+                pos.set(line, false, &st);
+                fens.push_back(pos.fen());
+                keys.push_back(pos.key());
             }
         }
-        else if (token == "skip")
+
+        results.assign(keys.size(), std::string());
+
+        probe_sorted(book, keys, [&](size_t i, const MappedBook& shard, size_t idx) {
+            std::vector<std::string> json_moves;
+
+            if (idx != shard.size())
+                probe_key(json_moves, shard, idx, limit, skip);
+
+            results[i] = position_json(fens[i], keys[i], json_moves);
+        });
+
+        for (const std::string& r : results)
         {
-            is >> token;
-            // There is no need to validate the bounds of skip as once can be
-            // skipping a lot of games in a large DB.
-            std::stringstream to_size_t(token);
-            to_size_t >> skip;
+            os << comma << r;
+            comma = ",\n";
         }
-        else
+
+        os.flush();
+    }
+
+    os << "\n]" << std::endl;
+    return "";
+}
+
+
+std::string explore(std::istringstream& is, std::ostream& os) {
+
+    std::string bookName, token, fenStr;
+    size_t limit = 10, skip = 0;
+    is >> bookName;
+
+    if (bookName.empty())
+        return "Missing book file name...";
+
+    while (is >> token)
+        if (!read_limits(is, token, limit, skip))
             fenStr += token + " ";
 
+    if (limit < 1)
+        return "limit must be greater than 1";
+
     if (fenStr.empty())
+        return "Missing FEN string...";
+
+    ShardedBook book;
+    std::string error = open_sharded(bookName, book);
+
+    if (!error.empty())
+        return error;
+
+    StateInfo st, childSt;
+    Position pos;
+    pos.set(fenStr, false, &st);
+
+    // Child keys are computed incrementally by do_move(), then the position
+    // and all its children are probed together in a single sorted sweep.
+    MoveList<LEGAL> legalMoves(pos);
+    std::vector<Move> moves(legalMoves.begin(), legalMoves.end());
+    std::vector<Key> keys;
+
+    for (Move m : moves)
     {
-        std::cerr << "Missing FEN string..." << std::endl;
-        exit(0);
+        Position child = pos; // Cheaper than undo_move(), that is not needed elsewhere
+        child.do_move(m, childSt, pos.gives_check(m));
+        keys.push_back(child.key());
     }
 
-    StateInfo st;
-    RootPos.set(fenStr, false, &st);
-    bool found = false;
-    size_t ofs = book.probe(RootPos.key(), bookName, &found);
+    keys.push_back(pos.key());
+
+    std::vector<std::array<uint64_t, 4>> results(moves.size());
     std::vector<std::string> json_moves;
-    if (found)
-        probe_key(json_moves, bookName, ofs, limit, skip);
+    std::vector<Key> coldKeys;
+    std::vector<size_t> cold;
+    bool more;
+
+    // Hot positions, typically all of them in the opening, skip the sweep
+    for (size_t i = 0; i < keys.size(); ++i)
+        if (i == moves.size() ? !probe_hot(json_moves, more, book.of(keys[i]), keys[i], limit, skip)
+                              : !hot_results(book.of(keys[i]), keys[i], results[i].data()))
+        {
+            coldKeys.push_back(keys[i]);
+            cold.push_back(i);
+        }
+
+    probe_sorted(book, coldKeys, [&](size_t j, const MappedBook& shard, size_t idx) {
+        size_t i = cold[j];
+
+        if (idx == shard.size())
+            return;
+
+        if (i == moves.size())
+            probe_key(json_moves, shard, idx, limit, skip);
+        else
+            count_results(shard, idx, results[i].data());
+    });
+
+    std::vector<size_t> order(moves.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+
+    auto games = [&](size_t i) { return results[i][0] + results[i][1] + results[i][2] + results[i][3]; };
+
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return games(a) > games(b);
+    });
+
+    std::string tab = "\n    ";
+    std::string indent8 = "        ";
+    std::string children = "," + tab + "\"children\": [", comma;
+
+    for (size_t i : order)
+    {
+        children += comma + tab + "   {" + tab + indent8
+                  +   "\"move\": \"" + UCI::move(moves[i], pos.is_chess960()) + "\""
+                  + ", \"key\": "    + std::to_string(keys[i])
+                  + ", \"games\": "  + std::to_string(games(i))
+                  + ", \"wins\": "   + std::to_string(results[i][0])
+                  + ", \"losses\": " + std::to_string(results[i][1])
+                  + ", \"draws\": "  + std::to_string(results[i][2])
+                  + tab + "   }";
+        comma = ",";
+    }
+
+    children += tab + "]";
+
+    os << position_json(pos.fen(), pos.key(), json_moves, children) << std::endl;
+    return "";
+}
+
+
+std::string find_line(std::istringstream& is, std::ostream& os) {
+
+    std::string bookName, token, fenStr;
+    is >> bookName >> token;
+
+    if (bookName.empty())
+        return "Missing book file name...";
+
+    // Same syntax of the UCI "position" command
+    if (token == "startpos")
+    {
+        fenStr = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+        is >> token; // Consume "moves" token if any
+    }
+    else if (token == "fen")
+        while (is >> token && token != "moves")
+            fenStr += token + " ";
+
+    if (fenStr.empty())
+        return "Missing startpos or fen...";
+
+    ShardedBook book;
+    std::string error = open_sharded(bookName, book);
+
+    if (!error.empty())
+        return error;
+
+    std::deque<StateInfo> states(1);
+    Position pos;
+    pos.set(fenStr, false, &states.back());
+
+    std::string fen = pos.fen();
+    std::vector<std::string> moves(1);
+    std::vector<Key> keys(1, pos.key());
+    Move m;
+
+    while (is >> token && (m = UCI::to_move(pos, token)) != MOVE_NONE)
+    {
+        states.emplace_back();
+        pos.do_move(m, states.back(), pos.gives_check(m));
+        moves.push_back(token);
+        keys.push_back(pos.key());
+    }
+
+    std::vector<std::array<uint64_t, 4>> results(keys.size());
+
+    probe_sorted(book, keys, [&](size_t i, const MappedBook& shard, size_t idx) {
+        if (idx != shard.size())
+            count_results(shard, idx, results[i].data());
+    });
 
     // Output probing info in JSON format
     std::string tab = "\n    ";
     std::string indent8 = "        ";
+    std::string comma, leaves = "null";
     std::stringstream json;
     json << "{"
-         << tab << "\"fen\": \"" << RootPos.fen() << "\","
-         << tab << "\"key\": " << RootPos.key() << ","
-         << tab << "\"moves\": [";
+         << tab << "\"fen\": \"" << fen << "\","
+         << tab << "\"plies\": [";
+
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        uint64_t games = results[i][0] + results[i][1] + results[i][2] + results[i][3];
+
+        if (!games && leaves == "null")
+            leaves = std::to_string(i);
+
+        json << comma << tab << "   {" << tab << indent8
+             <<   "\"ply\": "    << i
+             << ", \"move\": \"" << moves[i] << "\""
+             << ", \"key\": "    << keys[i]
+             << ", \"games\": "  << games
+             << ", \"wins\": "   << results[i][0]
+             << ", \"losses\": " << results[i][1]
+             << ", \"draws\": "  << results[i][2]
+             << tab << "   }";
+        comma = ",";
+    }
+
+    json << tab << "],"
+         << tab << "\"leaves at ply\": " << leaves << "\n}";
 
+    os << json.str() << std::endl;
+    return "";
+}
+
+
+/// games() returns the PGN text of the games at the given offsets, as found in
+/// the "pgn offsets" of a query. Offsets are rounded down to a multiple of 8 in
+/// the book, so a game starts at the first "[Event " tag from its offset on.
+
+std::string games(std::istringstream& is, std::ostream& os) {
+
+    std::string pgnName, token, line;
+    std::vector<uint64_t> offsets;
+    std::vector<Source> sources;
+    is >> pgnName;
+
+    if (pgnName.empty())
+        return "Missing PGN file name...";
+
+    // Games of a merged book are read from the PGN file of their source
+    if (!read_sources(sources_name(pgnName), sources))
+        sources.push_back({ 0, file_size(pgnName), pgnName });
+
+    uint64_t size = sources.back().base + sources.back().size;
+
+    while (is >> token)
+    {
+        char* end;
+        uint64_t ofs = std::strtoull(token.c_str(), &end, 10);
+
+        if (*end || token[0] == '-' || ofs >= size)
+            return "Invalid game offset " + token;
+
+        offsets.push_back(ofs);
+    }
+
+    std::string tab = "\n    ";
     std::string comma;
-    for (auto& m : json_moves)
+    std::stringstream json;
+    std::ifstream ifs;
+    const Source* opened = nullptr;
+    json << "[";
+
+    for (uint64_t ofs : offsets)
     {
-        json << comma << tab << "   {" << tab << indent8 << m << tab << "   }";
+        const Source* src = &sources[0];
+        while (src + 1 < &sources[0] + sources.size() && (src + 1)->base <= ofs)
+            ++src;
+
+        if (src != opened)
+        {
+            ifs.close();
+            ifs.open(src->pgn, std::ifstream::in | std::ifstream::binary);
+            if (!ifs.is_open())
+                return "Could not open " + src->pgn;
+
+            opened = src;
+        }
+
+        std::string game;
+        ifs.clear();
+        ifs.seekg(ofs - src->base);
+
+        while (std::getline(ifs, line))
+            if (line.compare(0, 8, "[Event \"") == 0)
+            {
+                if (!game.empty())
+                    break; // Start of next game
+
+                game = line + "\n";
+            }
+            else if (!game.empty())
+                game += line + "\n";
+
+        game.erase(game.find_last_not_of(" \t\r\n") + 1);
+
+        json << comma << tab << "{ \"offset\": " << ofs << ", \"pgn\": " << json_string(game) << " }";
         comma = ",";
     }
 
-    json << tab << "]\n}";
-    std::cout << json.str() << std::endl;
+    json << "\n]";
+    os << json.str() << std::endl;
+    return "";
+}
+
+
+/// cache() sets the number of find results kept in the cache, 0 to disable it.
+/// Cached results are dropped.
+
+std::string cache(std::istringstream& is, std::ostream&) {
+
+    size_t entries;
+
+    if (!(is >> entries))
+        return "Missing number of cache entries...";
+
+    FindCache.resize(entries);
+    return "";
+}
+
+
+/// stats() reports the number of mapped books and the hit rate of the cache
+
+std::string stats(std::istringstream&, std::ostream& os) {
+
+    uint64_t hits = FindCache.hits, misses = FindCache.misses;
+    std::string tab = "\n    ";
+    std::stringstream json;
+    json << "{"
+         << tab << "\"Books mapped\": " << Books::mapped() << ","
+         << tab << "\"Cache entries\": " << FindCache.size() << ","
+         << tab << "\"Cache capacity\": " << FindCache.capacity() << ","
+         << tab << "\"Cache hits\": " << hits << ","
+         << tab << "\"Cache misses\": " << misses << ","
+         << tab << "\"Cache hit rate (%)\": " << (hits + misses ? 100 * hits / (hits + misses) : 0) << ","
+         << tab << "\"Hot table hits\": " << HotHits << ","
+         << tab << "\"Prefetches\": " << Prefetches << "\n"
+         << "}";
+
+    os << json.str() << std::endl;
+    return "";
 }
 
 }
@@ -1162,6 +1162,55 @@ Move Position::san_to_move(const char* cur, const char* end, size_t& fixed) cons
 }
 
 
+/// Position::lan_to_move() converts a move in coordinate notation, e2e4 or
+/// e7e8q, to the corresponding legal Move, or MOVE_NONE. Unlike UCI::to_move()
+/// the move is built straight from its squares and the piece moved, without
+/// generating the legal moves, save for the rare non normal ones. Castling can
+/// be given as a king move, e1g1, or as the king taking its rook, e1h1.
+
+Move Position::lan_to_move(const char* cur, size_t len) const {
+
+  if (   (len != 4 && len != 5)
+      || cur[0] < 'a' || cur[0] > 'h' || cur[1] < '1' || cur[1] > '8'
+      || cur[2] < 'a' || cur[2] > 'h' || cur[3] < '1' || cur[3] > '8')
+      return MOVE_NONE;
+
+  Color us = sideToMove;
+  Square from = make_square(File(cur[0] - 'a'), Rank(cur[1] - '1'));
+  Square to   = make_square(File(cur[2] - 'a'), Rank(cur[3] - '1'));
+  Piece pc = piece_on(from);
+  Move m;
+
+  if (len == 5)
+  {
+      const char* promotions = "nbrq";
+      const char* p = strchr(promotions, tolower(cur[4]));
+      if (!p || !cur[4])
+          return MOVE_NONE;
+
+      m = make<PROMOTION>(from, to, PieceType(KNIGHT + (p - promotions)));
+  }
+  else if (pc == make_piece(us, KING) && piece_on(to) == make_piece(us, ROOK))
+      m = make<CASTLING>(from, to);
+
+  else if (pc == make_piece(us, KING) && distance<File>(from, to) == 2)
+  {
+      CastlingRight cr = CastlingRight(WHITE_OO << ((to < from) + 2 * us));
+      if (!can_castle(cr))
+          return MOVE_NONE;
+
+      m = make<CASTLING>(from, castling_rook_square(cr));
+  }
+  else if (pc == make_piece(us, PAWN) && to == ep_square())
+      m = make<ENPASSANT>(from, to);
+
+  else
+      m = make_move(from, to);
+
+  return pseudo_legal(m) && legal(m) ? m : MOVE_NONE;
+}
+
+
 /// Position::pos_is_ok() performs some consistency checks for the position object.
 /// This is meant to be helpful when debugging.
 
@@ -151,6 +151,7 @@ public:
   bool move_is_uci(Move m, const char* ref) const;
   template<bool Strict = true> bool move_is_san(Move m, const char* ref) const;
   Move san_to_move(const char* cur, const char* end, size_t& fixed) const;
+  Move lan_to_move(const char* cur, size_t len) const;
 
   // Position consistency check, for debugging
   bool pos_is_ok(int* failedStep = nullptr) const;
@@ -0,0 +1,91 @@
+#!/usr/bin/env python
+
+'''Replay a click-through trace against a parser serving a book, with and
+   without prefetching the children of the positions asked, and report the
+   latency percentiles of both runs. The trace is a set of random walks from
+   the start position, each ply picking a book move with probability
+   proportional to its games, as an explorer user does.'''
+
+import argparse
+import json
+import os
+import random
+import subprocess
+import tempfile
+import time
+
+from chess_db import Parser, Client
+
+START = 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1'
+
+
+def fen_after(p, moves):
+    p.p.sendline('position startpos moves ' + ' '.join(moves))
+    p.p.sendline('d')
+    p.wait_ready()
+    fen = p.p.before.split('Fen: ', 1)[1].splitlines()[0]
+    p.p.before = ''
+    return fen.strip()
+
+
+def make_trace(path, book, walks, depth, seed):
+    random.seed(seed)
+    p = Parser(path)
+    p.db = book
+    trace = []
+    for _ in range(walks):
+        moves, fen = [], START
+        for _ in range(depth):
+            trace.append(fen)
+            candidates = p.find(fen)['moves']
+            if not candidates:
+                break
+            weights = [m['games'] for m in candidates]
+            moves.append(random.choices(candidates, weights)[0]['move'])
+            fen = fen_after(p, moves)
+    p.close()
+    return trace
+
+
+def replay(path, book, trace, prefetch, think):
+    sock = os.path.join(tempfile.mkdtemp(), 'replay.sock')
+    server = subprocess.Popen([path, 'serve', sock, 'prefetch', str(prefetch)],
+                              stdout=subprocess.PIPE)
+    server.stdout.readline()
+    c = Client(sock)
+    latencies = []
+    for fen in trace:
+        c.find(book, fen)
+        latencies.append(c.latency)
+        time.sleep(think / 1000.0)
+    stats = c.stats()
+    c.close(shutdown=True)
+    server.wait()
+    latencies.sort()
+    pct = lambda q: latencies[min(len(latencies) - 1, int(q * len(latencies)))]
+    return {'Prefetch': prefetch, 'Queries': len(latencies),
+            'Mean latency (us)': sum(latencies) // max(len(latencies), 1),
+            'p50 latency (us)': pct(0.50), 'p99 latency (us)': pct(0.99),
+            'Cache hits': stats['Cache hits'], 'Prefetches': stats['Prefetches']}
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='Replay a click-through trace')
+    parser.add_argument('book', help='book file ending in .bin')
+    parser.add_argument('--path', default='./parser')
+    parser.add_argument('--walks', type=int, default=200)
+    parser.add_argument('--depth', type=int, default=20)
+    parser.add_argument('--prefetch', type=int, default=3,
+                        help='book moves whose children are prefetched')
+    parser.add_argument('--think', type=float, default=5,
+                        help='msec between two clicks')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    trace = make_trace(args.path, args.book, args.walks, args.depth, args.seed)
+    with open(args.book, 'rb') as f:  # Same page cache state for both runs
+        while f.read(1 << 24):
+            pass
+    result = [replay(args.path, args.book, trace, n, args.think)
+              for n in (0, args.prefetch)]
+    print(json.dumps(result, indent=4))
@@ -0,0 +1,778 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <csignal>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+#include "book.h"
+#include "misc.h"
+#include "server.h"
+#include "thread.h"
+
+namespace Parser {
+  std::string find(std::istringstream& is, std::ostream& os);
+  std::string explore(std::istringstream& is, std::ostream& os);
+  std::string find_line(std::istringstream& is, std::ostream& os);
+  std::string prefetch(std::istringstream& is, std::ostream& os);
+  std::string games(std::istringstream& is, std::ostream& os);
+  std::string ingest(std::istringstream& is, std::ostream& os);
+  std::string cache(std::istringstream& is, std::ostream& os);
+  std::string stats(std::istringstream& is, std::ostream& os);
+}
+
+namespace {
+
+#ifndef _WIN32
+
+  // Latencies are collected in buckets of powers of 2 usec, enough to report
+  // percentiles within a factor of 2 without any lock on the request path.
+  const int LatencyBuckets = 32;
+
+  // Longest HTTP request head we accept, bodies are not accepted at all
+  const size_t MaxHeadSize = 8192;
+
+  // Longest request line we accept, a move list of a very long game fits
+  const size_t MaxLineSize = 65536;
+
+  // Prefetches waiting for the prefetch thread, others are dropped: a guess
+  // that comes too late is useless.
+  const size_t MaxPendingPrefetches = 4;
+
+  struct Stats {
+    std::atomic<uint64_t> requests, errors, totalUsec;
+    std::atomic<uint64_t> buckets[LatencyBuckets];
+  };
+
+  struct Limits {
+    size_t threads = std::max(std::thread::hardware_concurrency(), 1U);
+    size_t connections = 256; // Open at the same time, others are turned away
+    size_t requests = 1000;   // Per connection, then it is closed
+    size_t games = 100;       // Per /games request
+    size_t limit = 1000;      // Game offsets per move of a /find or /explore page
+    TimePoint timeout = 0;    // Idle msec before a connection is closed, 0 = never
+    size_t prefetch = 0;      // Book moves whose children are prefetched, 0 = off
+  };
+
+  struct Connection {
+    int fd;
+    std::string pending; // Received bytes not yet making a complete request
+    size_t requests;
+    TimePoint lastActive;
+  };
+
+  // A handler answers the complete requests in c->pending, removing them, and
+  // returns false when the connection should be closed.
+  typedef bool (*Handler)(Connection* c);
+
+  int wakeFd[2];
+  std::mutex mutex;
+  std::vector<Connection*> returned; // Connections handed back by the workers
+  std::atomic<bool> stop;
+  std::atomic<size_t> connections, pendingPrefetches;
+  ThreadPool* prefetcher;
+  Stats stats;
+  Limits limits;
+  std::string bookName, pgnName; // Served over HTTP
+
+
+  // percentile() returns the upper bound, in usec, of the bucket holding the
+  // given fraction of the requests served so far.
+
+  uint64_t percentile(double p) {
+
+    uint64_t total = 0, cnt = 0;
+    for (auto& b : stats.buckets)
+        total += b;
+
+    for (int i = 0; i < LatencyBuckets; ++i)
+        if ((cnt += stats.buckets[i]) >= p * total && total)
+            return 1ULL << i;
+
+    return 0;
+  }
+
+  std::string stats_json() {
+
+    uint64_t requests = stats.requests;
+    std::string tab = "\n    ";
+    std::stringstream json, parser;
+    std::istringstream none;
+
+    // Merge in the fields of the parser, as the book count and cache hit rate
+    Parser::stats(none, parser);
+    std::string fields = parser.str();
+    fields = fields.substr(fields.find('{') + 1, fields.rfind('}') - fields.find('{') - 1);
+
+    json << "{"
+         << tab << "\"Requests\": " << requests << ","
+         << tab << "\"Errors\": " << stats.errors << ","
+         << tab << "\"Mean latency (us)\": " << (requests ? stats.totalUsec / requests : 0) << ","
+         << tab << "\"p50 latency (us)\": " << percentile(0.50) << ","
+         << tab << "\"p99 latency (us)\": " << percentile(0.99) << ","
+         << tab << "\"Connections\": " << connections << ","
+         << tab << "\"Threads\": " << limits.threads << ","
+         << fields << "}";
+    return json.str();
+  }
+
+  // record() accounts a request that started at 'start' and returns its latency
+
+  uint64_t record(std::chrono::steady_clock::time_point start, bool error) {
+
+    uint64_t usec = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+
+    int bucket = 0;
+    while (bucket < LatencyBuckets - 1 && (1ULL << bucket) < usec)
+        ++bucket;
+
+    stats.requests++;
+    stats.errors += error;
+    stats.totalUsec += usec;
+    stats.buckets[bucket]++;
+    return usec;
+  }
+
+  bool send_all(int fd, const std::string& s) {
+
+    for (size_t sent = 0; sent < s.size(); )
+    {
+        ssize_t n = ::send(fd, s.data() + sent, s.size() - sent, 0);
+        if (n <= 0)
+            return false;
+
+        sent += n;
+    }
+
+    return true;
+  }
+
+  void close_connection(Connection* c) {
+
+    ::close(c->fd);
+    delete c;
+    connections--;
+  }
+
+
+  // prefetch() queues the prefetch of the children of the position of a query
+  // just answered, given its arguments. The prefetch thread runs at the lowest
+  // priority, where supported, so that it only uses otherwise idle cores.
+
+  void prefetch(const std::string& args) {
+
+    if (   !limits.prefetch
+        || args.find("cursor") != std::string::npos // Next page, same position
+        || pendingPrefetches >= MaxPendingPrefetches)
+        return;
+
+    pendingPrefetches++;
+
+    prefetcher->submit([=]{
+#ifdef __linux__
+        static thread_local bool niced = !::setpriority(PRIO_PROCESS, ::syscall(SYS_gettid), 19);
+        (void)niced;
+#endif
+        std::istringstream is(args + " moves " + std::to_string(limits.prefetch));
+        std::stringstream os;
+        Parser::prefetch(is, os);
+        pendingPrefetches--;
+    });
+  }
+
+
+  // run_line() answers a single request line. The response is the output of
+  // the command followed by a status line, "ok <usec>" or "error <usec>
+  // <message>", that tells the client where the response ends. Returns false
+  // when the connection should be closed.
+
+  bool run_line(Connection* c, const std::string& cmd) {
+
+    auto start = std::chrono::steady_clock::now();
+    std::istringstream is(cmd);
+    std::stringstream os;
+    std::string token, error;
+
+    is >> std::skipws >> token;
+
+    if (token == "quit")
+        return false;
+
+    else if (token == "shutdown")
+    {
+        stop = true;
+        (void)::write(wakeFd[1], "", 1);
+        return false;
+    }
+    else if (token == "find" || token == "explore")
+    {
+        std::string args = cmd.substr(cmd.find(token) + token.size());
+        error = token == "find" ? Parser::find(is, os) : Parser::explore(is, os);
+
+        if (error.empty())
+            prefetch(args);
+    }
+    else if (token == "findline") error = Parser::find_line(is, os);
+    else if (token == "games")    error = Parser::games(is, os);
+    else if (token == "ingest")   error = Parser::ingest(is, os);
+    else if (token == "stats")    os << stats_json() << std::endl;
+    else if (token == "isready")  os << "readyok" << std::endl;
+    else
+        error = "Unknown command: " + cmd;
+
+    uint64_t usec = record(start, !error.empty());
+
+    os << (error.empty() ? "ok " : "error ") << usec
+       << (error.empty() ? "" : " " + error) << "\n";
+
+    return send_all(c->fd, os.str());
+  }
+
+  bool line_requests(Connection* c) {
+
+    for (size_t eol; (eol = c->pending.find('\n')) != std::string::npos; )
+    {
+        std::string cmd = c->pending.substr(0, eol);
+        c->pending.erase(0, eol + 1);
+
+        if (!cmd.empty() && cmd.back() == '\r')
+            cmd.pop_back();
+
+        if (cmd.find_first_not_of(" \t") != std::string::npos && !run_line(c, cmd))
+            return false;
+    }
+
+    if (c->pending.size() > MaxLineSize)
+    {
+        send_all(c->fd, "error 0 Request line too long\n");
+        return false;
+    }
+
+    return true;
+  }
+
+
+  // url_decode() decodes a percent-encoded query string component
+
+  std::string url_decode(const std::string& s) {
+
+    std::string out;
+
+    for (size_t i = 0; i < s.size(); ++i)
+        if (s[i] == '+')
+            out += ' ';
+
+        else if (   s[i] == '%' && i + 2 < s.size()
+                 && isxdigit(s[i + 1]) && isxdigit(s[i + 2]))
+        {
+            out += char(std::strtol(s.substr(i + 1, 2).c_str(), nullptr, 16));
+            i += 2;
+        }
+        else
+            out += s[i];
+
+    return out;
+  }
+
+  // query_param() returns the decoded value of a parameter of a query string
+
+  std::string query_param(const std::string& query, const std::string& name) {
+
+    std::istringstream ss(query);
+    std::string kv;
+
+    while (std::getline(ss, kv, '&'))
+        if (kv.compare(0, name.size() + 1, name + "=") == 0)
+            return url_decode(kv.substr(name.size() + 1));
+
+    return "";
+  }
+
+
+  // count_param() reads a parameter that is a count, in decimal digits only,
+  // so that it cannot bring other arguments along. Absent is 'n' unchanged.
+
+  bool count_param(const std::string& value, size_t& n) {
+
+    if (value.empty())
+        return true;
+
+    if (value.size() > 9 || value.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+
+    n = std::stoul(value);
+    return true;
+  }
+
+
+  // fen_param() checks that a parameter is made of the fields of a FEN string
+  // only, so that it cannot bring other arguments along.
+
+  bool fen_param(const std::string& fen) {
+
+    // Board, side to move, castling rights (also Chess960 files), en passant
+    // square, then the two move counters
+    static const char* Fields[] = { "pnbrqkPNBRQK12345678/", "wb", "KQkqABCDEFGHabcdefgh-",
+                                    "abcdefgh36-", "0123456789", "0123456789" };
+    std::istringstream ss(fen);
+    std::string field;
+    size_t n = 0;
+
+    for ( ; ss >> field; ++n)
+        if (n >= 6 || field.find_first_not_of(Fields[n]) != std::string::npos)
+            return false;
+
+    return n > 0;
+  }
+
+
+  // run_http() answers a single HTTP request, given its head. Parameters are
+  // turned into the arguments of the corresponding command, so that HTTP and
+  // the other front ends share the same parsing and error checking. Books are
+  // fixed when the server starts: clients cannot name files.
+
+  bool run_http(Connection* c, const std::string& head) {
+
+    auto start = std::chrono::steady_clock::now();
+    std::istringstream hs(head);
+    std::string method, target, version, line;
+    std::stringstream os;
+    std::string status = "200 OK", error;
+    bool keepAlive, hasBody = false;
+
+    hs >> method >> target >> version;
+
+    keepAlive = version == "HTTP/1.1";
+
+    std::getline(hs, line); // Rest of the request line
+    while (std::getline(hs, line))
+    {
+        std::string name = line.substr(0, line.find(':'));
+        std::string value = line.substr(std::min(name.size() + 1, line.size()));
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+
+        if (name == "connection")
+            keepAlive = value.find("close") == std::string::npos
+                     && (keepAlive || value.find("keep-alive") != std::string::npos);
+
+        else if (name == "content-length" || name == "transfer-encoding")
+            hasBody = true;
+    }
+
+    size_t q = target.find('?');
+    std::string path = target.substr(0, q);
+    std::string query = q == std::string::npos ? "" : target.substr(q + 1);
+    std::string fen = query_param(query, "fen");
+    size_t limit = 10, skip = 0;
+
+    if (method != "GET")
+        status = "405 Method Not Allowed", error = "Only GET is supported";
+
+    else if (hasBody) // Would be read as the next request
+        status = "413 Payload Too Large", error = "Request bodies are not accepted";
+
+    else if (path == "/explore" || path == "/find")
+    {
+        if (   !count_param(query_param(query, "limit"), limit)
+            || !count_param(query_param(query, "skip"), skip))
+            error = "limit and skip must be numbers";
+
+        else if (!fen_param(fen))
+            error = "Invalid fen " + fen;
+
+        else
+        {
+            std::istringstream is(  bookName + " limit " + std::to_string(std::min(limit, limits.limit))
+                                  + " skip " + std::to_string(skip) + " " + fen);
+            error = path == "/find" ? Parser::find(is, os) : Parser::explore(is, os);
+
+            if (error.empty())
+                prefetch(is.str());
+        }
+    }
+    else if (path == "/games")
+    {
+        std::string ids = query_param(query, "ids");
+        std::replace(ids.begin(), ids.end(), ',', ' ');
+
+        if (std::count(ids.begin(), ids.end(), ' ') >= (long)limits.games)
+            error = "Too many ids, at most " + std::to_string(limits.games) + " per request";
+        else
+        {
+            std::istringstream is(pgnName + " " + ids);
+            error = Parser::games(is, os);
+        }
+    }
+    else if (path == "/stats")
+        os << stats_json() << std::endl;
+
+    else
+        status = "404 Not Found", error = "Unknown path " + path;
+
+    if (!error.empty())
+    {
+        status = status == "200 OK" ? "400 Bad Request" : status;
+        os.str("");
+        os << "{\n    \"error\": " << json_string(error) << "\n}" << std::endl;
+    }
+
+    record(start, !error.empty());
+
+    keepAlive = keepAlive && !hasBody && ++c->requests < limits.requests;
+
+    std::string body = os.str();
+    std::stringstream response;
+    response << "HTTP/1.1 " << status << "\r\n"
+             << "Content-Type: application/json\r\n"
+             << "Content-Length: " << body.size() << "\r\n"
+             << "Connection: " << (keepAlive ? "keep-alive" : "close") << "\r\n"
+             << "\r\n" << body;
+
+    return send_all(c->fd, response.str()) && keepAlive;
+  }
+
+  bool http_requests(Connection* c) {
+
+    for (size_t end; (end = c->pending.find("\r\n\r\n")) != std::string::npos; )
+    {
+        std::string head = c->pending.substr(0, end);
+        c->pending.erase(0, end + 4);
+
+        if (!run_http(c, head))
+            return false;
+    }
+
+    if (c->pending.size() > MaxHeadSize)
+    {
+        send_all(c->fd, "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+                        "Content-Length: 0\r\nConnection: close\r\n\r\n");
+        return false;
+    }
+
+    return true;
+  }
+
+
+  // serve_connection() runs on a worker thread when a connection has data to
+  // read. It answers all the complete requests received so far, then hands the
+  // connection back to the main thread to wait for more.
+
+  void serve_connection(Connection* c, Handler handler) {
+
+    char buf[4096];
+    ssize_t n = ::recv(c->fd, buf, sizeof(buf), 0);
+
+    if (n <= 0 || (c->pending.append(buf, n), !handler(c)))
+    {
+        close_connection(c);
+        return;
+    }
+
+    c->lastActive = now();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    returned.push_back(c);
+    (void)::write(wakeFd[1], "", 1);
+  }
+
+
+  // event_loop() accepts connections on a listening socket and polls the idle
+  // ones. A connection with a pending request is served by a worker thread, and
+  // is not polled meanwhile, so a client gets its responses in the same order as
+  // its requests. A connection over the limit gets the 'busy' response and is
+  // closed. Returns after a "shutdown" request.
+
+  void event_loop(int listenFd, Handler handler, const std::string& busy) {
+
+    if (::pipe(wakeFd))
+    {
+        std::cerr << "Could not create pipe: " << std::strerror(errno) << std::endl;
+        return;
+    }
+
+    // A client that goes away while being answered must not kill the server
+    std::signal(SIGPIPE, SIG_IGN);
+
+    stop = false;
+    connections = 0;
+    pendingPrefetches = 0;
+    std::vector<Connection*> idle;
+
+    {
+        ThreadPool prefetchPool(1); // Destroyed last, after the requests in flight
+        ThreadPool pool(limits.threads);
+        prefetcher = &prefetchPool;
+        std::vector<pollfd> fds;
+
+        while (!stop)
+        {
+            fds.assign({ { listenFd, POLLIN, 0 }, { wakeFd[0], POLLIN, 0 } });
+            for (Connection* c : idle)
+                fds.push_back({ c->fd, POLLIN, 0 });
+
+            if (::poll(fds.data(), fds.size(), limits.timeout ? 1000 : -1) < 0)
+                continue; // Interrupted by a signal
+
+            std::vector<Connection*> waiting;
+            for (size_t i = 0; i < idle.size(); ++i)
+            {
+                Connection* c = idle[i];
+
+                if (fds[i + 2].revents)
+                    pool.submit([=]{ serve_connection(c, handler); });
+
+                else if (limits.timeout && now() - c->lastActive > limits.timeout)
+                    close_connection(c);
+                else
+                    waiting.push_back(c);
+            }
+
+            idle.swap(waiting);
+
+            if (fds[1].revents)
+            {
+                char buf[64];
+                (void)::read(wakeFd[0], buf, sizeof(buf));
+
+                std::lock_guard<std::mutex> lock(mutex);
+                idle.insert(idle.end(), returned.begin(), returned.end());
+                returned.clear();
+            }
+
+            if (fds[0].revents)
+            {
+                int fd = ::accept(listenFd, nullptr, nullptr);
+
+                if (fd >= 0 && connections >= limits.connections)
+                {
+                    send_all(fd, busy);
+                    ::close(fd);
+                }
+                else if (fd >= 0)
+                {
+                    connections++;
+                    idle.push_back(new Connection{ fd, "", 0, now() });
+                }
+            }
+        }
+    } // Wait for the requests in flight
+
+    idle.insert(idle.end(), returned.begin(), returned.end());
+    returned.clear();
+
+    for (Connection* c : idle)
+        close_connection(c);
+
+    ::close(wakeFd[0]);
+    ::close(wakeFd[1]);
+  }
+
+  // read_limits() parses the server options common to all the front ends
+
+  bool read_limits(std::istringstream& is, const std::string& token) {
+
+    if (token == "threads")
+        is >> limits.threads;
+    else if (token == "connections")
+        is >> limits.connections;
+    else if (token == "requests")
+        is >> limits.requests;
+    else if (token == "games")
+        is >> limits.games;
+    else if (token == "limit")
+        is >> limits.limit;
+    else if (token == "prefetch")
+        is >> limits.prefetch;
+    else if (token == "timeout")
+    {
+        is >> limits.timeout;
+        limits.timeout *= 1000;
+    }
+    else if (token == "cache")
+    {
+        std::string entries;
+        is >> entries;
+        std::istringstream cs(entries);
+        Parser::cache(cs, std::cout);
+    }
+    else
+        return false;
+
+    limits.threads = std::max(limits.threads, size_t(1));
+    return true;
+  }
+
+#endif
+
+} // namespace
+
+namespace Server {
+
+/// Server::serve() listens on a Unix domain socket for query commands, one per
+/// line, and answers them on a pool of worker threads. Unlike spawning a
+/// parser per query, initialization is paid once and books stay mapped across
+/// requests, so a query costs just its probe. With "prefetch N" the children of
+/// the N most played moves of each position queried are cached in advance.
+/// Runs until a "shutdown" request.
+
+void serve(std::istringstream& is) {
+
+#ifdef _WIN32
+  (void)is;
+  std::cerr << "serve is not supported on Windows" << std::endl;
+#else
+  std::string path, token;
+  is >> path;
+
+  if (path.empty())
+  {
+      std::cerr << "Missing socket path..." << std::endl;
+      return;
+  }
+
+  limits = Limits();
+  while (is >> token)
+      read_limits(is, token);
+
+  sockaddr_un addr = sockaddr_un();
+  addr.sun_family = AF_UNIX;
+
+  if (path.size() >= sizeof(addr.sun_path))
+  {
+      std::cerr << "Socket path too long: " << path << std::endl;
+      return;
+  }
+
+  std::strcpy(addr.sun_path, path.c_str());
+  ::unlink(path.c_str()); // Left over by a previous server
+
+  int listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (   listenFd < 0
+      || ::bind(listenFd, (sockaddr*)&addr, sizeof(addr))
+      || ::listen(listenFd, SOMAXCONN))
+  {
+      std::cerr << "Could not listen on " << path << ": " << std::strerror(errno) << std::endl;
+      return;
+  }
+
+  std::cout << "{\n    \"Socket\": \"" << path << "\",\n    \"Threads\": "
+            << limits.threads << "\n}" << std::endl;
+
+  event_loop(listenFd, line_requests, "error 0 Too many connections\n");
+
+  ::close(listenFd);
+  ::unlink(path.c_str());
+#endif
+}
+
+
+/// Server::http() serves a book over HTTP/1.1 on the loopback interface, with
+/// keep-alive connections answered by a pool of worker threads:
+///
+/// GET /explore?fen=<fen>[&limit=N][&skip=N]  Same as the "explore" command
+/// GET /find?fen=<fen>[&limit=N][&skip=N]     Same as the "find" command
+/// GET /games?ids=<offset>,<offset>,...       PGN text of the games
+/// GET /stats                                 Request count and latency
+
+void http(std::istringstream& is) {
+
+#ifdef _WIN32
+  (void)is;
+  std::cerr << "http is not supported on Windows" << std::endl;
+#else
+  std::string token;
+  int port = 8080;
+  is >> bookName;
+
+  if (bookName.empty())
+  {
+      std::cerr << "Missing book file name..." << std::endl;
+      return;
+  }
+
+  limits = Limits();
+  limits.timeout = 5000;
+
+  while (is >> token)
+      if (token == "port")
+          is >> port;
+      else
+          read_limits(is, token);
+
+  size_t lastdot = bookName.find_last_of(".");
+  pgnName = bookName.substr(0, lastdot) + ".pgn";
+
+  sockaddr_in addr = sockaddr_in();
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  int one = 1;
+  int listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+
+  if (   listenFd < 0
+      || ::setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one))
+      || ::bind(listenFd, (sockaddr*)&addr, sizeof(addr))
+      || ::listen(listenFd, SOMAXCONN))
+  {
+      std::cerr << "Could not listen on port " << port << ": " << std::strerror(errno) << std::endl;
+      return;
+  }
+
+  // Port 0 picks a free port, tell which one
+  socklen_t len = sizeof(addr);
+  ::getsockname(listenFd, (sockaddr*)&addr, &len);
+
+  std::cout << "{\n    \"Port\": " << ntohs(addr.sin_port) << ",\n    \"Threads\": "
+            << limits.threads << "\n}" << std::endl;
+
+  event_loop(listenFd, http_requests, "HTTP/1.1 503 Service Unavailable\r\n"
+                                      "Content-Length: 0\r\nConnection: close\r\n\r\n");
+  ::close(listenFd);
+#endif
+}
+
+}
@@ -3,11 +3,20 @@
 import argparse
 import hashlib
 import glob
+import itertools
 import json
 import os
+import shutil
+import struct
+import subprocess
 import sys
+import tempfile
+import time
+import urllib.error
+import urllib.parse
+import urllib.request
 from subprocess import STDOUT, check_output as qx
-from chess_db import Parser
+from chess_db import Client, Parser
 
 PARSER = './parser.exe' if 'nt' in os.name else './parser'
 
@@ -76,6 +85,16 @@ FIND_TEST = {
     }
 }
 
+BATCH_TEST = [
+    "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1",
+    "8/8/8/8/8/8/8/K6k w - - 0 1",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "rnbqkbnr/pppppppp/8/8/3P4/8/PPP1PPPP/RNBQKBNR b KQkq - 0 1",
+    "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1"
+]
+
+LINE_TEST = ['e2e4', 'e7e5', 'g1f3', 'b8c6', 'f1b5', 'a7a6', 'b5a4', 'g8f6', 'e1g1']
+
 
 def run_file(p, file, stats):
     fname = os.path.basename(file)
@@ -98,6 +117,722 @@ def run_file(p, file, stats):
     print('OK' if ok1 and ok2 and ok3 else 'FAIL')
 
 
+def run_federated_test(p, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for federated test...')
+    p.open(file)
+    books = [p.db, os.path.join(os.path.dirname(file), 'hayes.bin')]
+    single = []
+    for b in books:
+        p.db = b
+        single.append({m['move']: m for m in p.find(test['input'], limit=1000)['moves']})
+    p.db = ','.join(books)
+    merged = p.find(test['input'], limit=1000)
+    manifest = os.path.join(tempfile.mkdtemp(), 'books.txt')
+    with open(manifest, 'w') as f:
+        f.write('\n'.join(os.path.abspath(b) for b in books) + '\n')
+    p.db = manifest
+    ok = [m['games'] for m in p.find(test['input'], limit=1000)['moves']] == \
+         [m['games'] for m in merged['moves']]
+    for m in merged['moves']:
+        parts = [(b, s[m['move']]) for b, s in zip(books, single) if m['move'] in s]
+        ok = ok and m['games'] == sum(x['games'] for _, x in parts)
+        ok = ok and m['pgn offsets'] == [{'book': b, 'offset': o}
+                                         for b, x in parts for o in x['pgn offsets']]
+    ok = ok and len(merged['moves']) == len(set(single[0]) | set(single[1]))
+    shutil.rmtree(os.path.dirname(manifest))
+    p.db = books[0]
+    print('OK' if ok else 'FAIL')
+
+
+def run_append_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for append test...')
+    with open(os.path.splitext(file)[0] + '.pgn', 'rb') as f:
+        data = f.read()
+    tmp = tempfile.mkdtemp()
+    pgn, ref = os.path.join(tmp, 'append.pgn'), os.path.join(tmp, 'ref.pgn')
+    for name, text in ((pgn, data[:data.find(b'[Event ', len(data) // 2)]), (ref, data)):
+        with open(name, 'wb') as f:
+            f.write(text)
+    c = Parser(path)
+    c.open(pgn)
+    first = c.make()
+    shutil.copy(ref, pgn)  # Games are appended
+    result = c.make(append=True)
+    ok = result['Appended from offset'] is not None
+    ok = ok and first['Games'] + result['Games'] == DB[fname]['games']
+    # A PGN of the same size may have been edited, so the book is rebuilt
+    again = c.make(append=True)
+    ok = ok and again['Appended from offset'] is None
+    ok = ok and again['Games'] == DB[fname]['games']
+    c.open(ref)
+    with open(c.db, 'rb') as f1, open(result['Book file'], 'rb') as f2:
+        ok = ok and f1.read() == f2.read()
+    c.close()
+    shutil.rmtree(tmp)
+    print('OK' if ok else 'FAIL')
+
+
+def run_resume_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for resume test...')
+    p.open(file)
+    tmp = tempfile.mkdtemp()
+    pgn = os.path.join(tmp, 'resumed.pgn')
+    shutil.copy(os.path.splitext(file)[0] + '.pgn', pgn)
+    mbytes = os.path.getsize(pgn) / 4.0 / (1 << 20)
+    # The build dies writing the book, after all the chunks are checkpointed
+    blocker = os.path.join(tmp, 'resumed.bin')
+    os.mkdir(blocker)
+    qx([path, 'book', pgn, 'full', 'checkpoint', str(mbytes)], stderr=subprocess.DEVNULL)
+    ok = os.path.isfile(os.path.join(tmp, 'resumed.ckp'))
+    os.rmdir(blocker)
+    result = json.loads(qx([path, 'book', pgn, 'full', 'resume'], stderr=subprocess.DEVNULL))
+    ok = ok and result['Resumed from offset'] is not None
+    ok = ok and result['Games'] == DB[fname]['games']
+    ok = ok and not os.path.isfile(os.path.join(tmp, 'resumed.ckp'))
+    with open(p.db, 'rb') as f1, open(result['Book file'], 'rb') as f2:
+        ok = ok and f1.read() == f2.read()
+    shutil.rmtree(tmp)
+    print('OK' if ok else 'FAIL')
+
+
+def run_prune_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for prune test...')
+    tmp = tempfile.mkdtemp()
+    pgn = os.path.join(tmp, 'pruned.pgn')
+    shutil.copy(os.path.splitext(file)[0] + '.pgn', pgn)
+    # Only the first move of each game, and only if played in 2 games at least
+    cmd = [path, 'book', pgn, 'full', 'maxply', '1', 'mingames', '2']
+    result = json.loads(qx(cmd, stderr=subprocess.DEVNULL))
+    expected = [m for m in test['output']['moves'] if m['games'] >= 2]
+    ok = os.path.getsize(result['Book file']) == 16 * sum(m['games'] for m in expected)
+    db, p.db = p.db, result['Book file']
+    ok = ok and p.find(test['input'])['moves'] == expected
+    p.db = db
+    shutil.rmtree(tmp)
+    print('OK' if ok else 'FAIL')
+
+
+def run_archive_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for archive test...')
+    p.open(file)
+    tmp = tempfile.mkdtemp()
+    pgn = os.path.join(tmp, 'archived.pgn')
+    shutil.copy(os.path.splitext(file)[0] + '.pgn', pgn)
+    result = json.loads(qx([path, 'book', pgn, 'full', 'archive'], stderr=subprocess.DEVNULL))
+    ok = result['Size of archive file (bytes)'] > 0
+    os.remove(result['Book file'])
+    # The book is built again out of the archive alone
+    cdb = os.path.join(tmp, 'archived.cdb')
+    result = json.loads(qx([path, 'book', cdb, 'full'], stderr=subprocess.DEVNULL))
+    ok = ok and result['Games'] == DB[fname]['games']
+    with open(p.db, 'rb') as f1, open(result['Book file'], 'rb') as f2:
+        ok = ok and f1.read() == f2.read()
+    shutil.rmtree(tmp)
+    print('OK' if ok else 'FAIL')
+
+
+LAN_TEST = [
+    ('e2e4 e7e5 g1f3 b8c6 f1b5 a7a6 b5a4 g8f6 e1g1 1-0',
+     '1. e4 e5 2. Nf3 Nc6 3. Bb5 a6 4. Ba4 Nf6 5. O-O 1-0'),
+    ('e2e4 e7e5 g1f3 b8c6 f1c4 g8f6 e1h1 f8e7 *',
+     '1. e4 e5 2. Nf3 Nc6 3. Bc4 Nf6 4. O-O Be7 *'),
+    ('a2a4 b7b5 a4b5 a7a6 b5a6 c8b7 a6b7 d7d6 b7a8N d8c8 0-1',
+     '1. a4 b5 2. axb5 a6 3. bxa6 Bb7 4. axb7 d6 5. bxa8=N Qc8 0-1'),
+    ('e2e4 a7a6 e4e5 d7d5 e5d6 1/2-1/2',
+     '1. e4 a6 2. e5 d5 3. exd6 1/2-1/2'),
+    ('fen 4k2r/8/8/8/8/8/8/R3K3 w Qk - 0 1 moves e1c1 e8g8 *',
+     '[FEN "4k2r/8/8/8/8/8/8/R3K3 w Qk - 0 1"]\n\n1. O-O-O O-O *')
+]
+
+
+def run_lan_test(p, path):
+    sys.stdout.write('Processing move lists for lan test...')
+    tmp = tempfile.mkdtemp()
+    uci, pgn = os.path.join(tmp, 'lan.uci'), os.path.join(tmp, 'san.pgn')
+    with open(uci, 'w') as f:
+        f.write(''.join(lan + '\n' for lan, _ in LAN_TEST))
+    with open(pgn, 'w') as f:
+        f.write(''.join('[Event "?"]\n' + san + '\n\n' for _, san in LAN_TEST))
+    books = [json.loads(qx([path, 'book', name, 'full'], stderr=subprocess.DEVNULL))
+             for name in (uci, pgn)]
+    ok = books[0]['Games'] == len(LAN_TEST) and books[0]['Incorrect moves'] == 0
+
+    # Same entries, but for the game offsets
+    def entries(book):
+        with open(book, 'rb') as f:
+            return sorted((k, m, w, l >> 30) for k, m, w, l in struct.iter_unpack('>QHHI', f.read()))
+
+    ok = ok and entries(books[0]['Book file']) == entries(books[1]['Book file'])
+    shutil.rmtree(tmp)
+    print('OK' if ok else 'FAIL')
+
+
+def run_live_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for live test...')
+    with open(os.path.splitext(file)[0] + '.pgn', 'rb') as f:
+        data = f.read()
+    tmp = tempfile.mkdtemp()
+    pgn, ref = os.path.join(tmp, 'live.pgn'), os.path.join(tmp, 'ref.pgn')
+    with open(ref, 'wb') as f:
+        f.write(data)
+    half = data.find(b'[Event ', len(data) // 2)
+    with open(pgn, 'wb') as f:
+        f.write(data[:half])
+    c = Parser(path)
+    c.open(pgn)
+    games = c.make()['Games']
+    # Games arrive in chunks of whole lines, even in the middle of a game. All
+    # but the last chunk are flushed to runs, that get compacted.
+    chunks = 8
+    for i in range(1, chunks + 1):
+        end = half + (len(data) - half) * i // chunks
+        with open(pgn, 'wb') as f:
+            f.write(data[:data.rfind(b'\n', 0, end) + 1 if i < chunks else end])
+        games += c.ingest(flush=1 if i < chunks else 10**9)['Games']
+    ok = games == DB[fname]['games']
+    fens = [test['input']] + BATCH_TEST
+    results = [c.find(f, limit=1000) for f in fens] + [c.find(f, limit=3, skip=2) for f in fens]
+    c.open(ref)
+    expected = [c.find(f, limit=1000) for f in fens] + [c.find(f, limit=3, skip=2) for f in fens]
+    ok = ok and results == expected
+    c.close()
+    shutil.rmtree(tmp)
+    print('OK' if ok else 'FAIL')
+
+
+def run_follow_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for follow test...')
+    with open(os.path.splitext(file)[0] + '.pgn', 'rb') as f:
+        data = f.read()
+    tmp = tempfile.mkdtemp()
+    pgn = os.path.join(tmp, 'follow.pgn')
+    half = data.find(b'[Event ', len(data) // 2)
+    with open(pgn, 'wb') as f:
+        f.write(data[:half])
+    c = Parser(path)
+    c.open(pgn)
+    job = c.make(follow=True)
+    # Games are written in two parts, the first one ending in a game
+    cut = data.rfind(b'\n', half, (half + len(data)) // 2) + 1
+    status = None
+    for part in (data[half:cut], data[cut:]):
+        with open(pgn, 'ab') as f:
+            f.write(part)
+        for _ in range(100):
+            status = c.status(job)
+            if status['Bytes total'] == os.path.getsize(pgn) and status['Bytes parsed'] >= cut:
+                break
+            time.sleep(0.05)
+    ok = status['Stage'] == 'following' and status['Lag (ms)'] >= 0
+    fens = [test['input']] + BATCH_TEST
+    results = [c.find(f, limit=1000) for f in fens]
+    c.unfollow()
+    ok = ok and c.status(job)['Stage'] == 'done'
+    c.make()
+    ok = ok and results == [c.find(f, limit=1000) for f in fens]
+    c.close()
+    # No other build of the book while following it, and quit stops the job
+    cmds = ['book {0} follow', 'book {0} async', 'book {0}', 'quit']
+    out = qx([path], input='\n'.join(cmds).format(pgn) + '\n', universal_newlines=True,
+             stderr=STDOUT)
+    ok = ok and out.count('Already following ' + pgn + ' in job 1') == 2
+    shutil.rmtree(tmp)
+    print('OK' if ok else 'FAIL')
+
+
+def run_reload_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for reload test...')
+    tmp = tempfile.mkdtemp()
+    pgn = os.path.join(tmp, 'reload.pgn')
+    shutil.copy(os.path.splitext(file)[0] + '.pgn', pgn)
+    reader, writer = Parser(path), Parser(path)
+    reader.open(pgn)
+    writer.open(pgn)
+    fens = [test['input']] + BATCH_TEST
+    expected = [reader.find(f, limit=1000) for f in fens]
+    # Queries keep running, and keep getting the same answers, while the book
+    # is rebuilt under them
+    ok = True
+    for _ in range(5):
+        job = writer.make(wait=False)
+        while ok and writer.status(job)['Stage'] not in ('done', 'failed'):
+            ok = [reader.find(f, limit=1000) for f in fens] == expected
+        ok = ok and writer.status(job)['Stage'] == 'done'
+    ok = ok and [reader.find(f, limit=1000) for f in fens] == expected
+    ok = ok and not os.path.exists(reader.db + '.tmp')
+    reader.close()
+    writer.close()
+    shutil.rmtree(tmp)
+    print('OK' if ok else 'FAIL')
+
+
+def run_shard_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for shard test...')
+    p.open(file)
+    tmp = tempfile.mkdtemp()
+    pgn = os.path.join(tmp, 'sharded.pgn')
+    shutil.copy(os.path.splitext(file)[0] + '.pgn', pgn)
+    result = json.loads(qx([path, 'book', pgn, 'full', 'shards', '4'], stderr=subprocess.DEVNULL))
+    manifest = result['Book file']
+    with open(manifest) as f:
+        shards = [os.path.join(tmp, line.strip()) for line in f if not line.startswith('#')]
+    ok = len(shards) == 4 and sum(os.path.getsize(s) for s in shards) == os.path.getsize(p.db)
+    fens = [test['input']] + BATCH_TEST
+    line = ['e2e4', 'e7e5', 'g1f3']
+    expected = ([p.find(f, limit=1000) for f in fens], p.find_batch(fens),
+                p.explore(test['input']), p.find_line(line))
+    db, p.db = p.db, manifest
+    ok = ok and ([p.find(f, limit=1000) for f in fens], p.find_batch(fens),
+                 p.explore(test['input']), p.find_line(line)) == expected
+    p.db = db
+    shutil.rmtree(tmp)
+    print('OK' if ok else 'FAIL')
+
+
+def run_reduce_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for reduce test...')
+    p.open(file)
+    tmp = tempfile.mkdtemp()
+    pgn = os.path.join(tmp, 'ranged.pgn')
+    shutil.copy(os.path.splitext(file)[0] + '.pgn', pgn)
+    size = os.path.getsize(pgn)
+    bounds = [0, size // 3, size // 3 + 1, size * 2 // 3, size]
+    runs = [json.loads(qx([path, 'book', pgn, 'range', str(a), str(b)],
+                          stderr=subprocess.DEVNULL))['Book file']
+            for a, b in zip(bounds, bounds[1:])]
+    book = os.path.join(tmp, 'ranged.bin')
+    result = json.loads(qx([path, 'reduce', book] + runs + ['full']))
+    with open(book, 'rb') as f, open(p.db, 'rb') as g:
+        ok = result['Runs merged'] == len(runs) and f.read() == g.read()
+    shutil.rmtree(tmp)
+    print('OK' if ok else 'FAIL')
+
+
+def run_merge_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for merge test...')
+    p.open(file)
+    books = [p.db, os.path.join(os.path.dirname(file), 'hayes.bin')]
+    merged = os.path.join(tempfile.mkdtemp(), 'merged.bin')
+    result = json.loads(qx([path, 'merge', merged] + books + ['full']))
+    ok = result['Entries'] * 16 == sum(os.path.getsize(b) for b in books)
+    stats = lambda r: [[m[k] for k in ('move', 'games', 'wins', 'losses', 'draws')]
+                       for m in r['moves']]
+    p.db = ','.join(books)
+    federated = [p.find(f, limit=1000) for f in [test['input']] + BATCH_TEST]
+    p.db = merged
+    results = [p.find(f, limit=1000) for f in [test['input']] + BATCH_TEST]
+    ok = ok and [stats(r) for r in results] == [stats(r) for r in federated]
+    # Offsets of the merged book are resolved to the PGN files of the sources
+    pgn = lambda b: os.path.splitext(b)[0] + '.pgn'
+    ofs = sum((m['pgn offsets'] for m in results[0]['moves']), [])
+    texts = [g['pgn'] for g in json.loads(qx([path, 'games', pgn(merged)] + [str(o) for o in ofs]))]
+    expected = [json.loads(qx([path, 'games', pgn(o['book']), str(o['offset'])]))[0]['pgn']
+                for m in federated[0]['moves'] for o in m['pgn offsets']]
+    ok = ok and sorted(texts) == sorted(expected) and all(texts)
+    shutil.rmtree(os.path.dirname(merged))
+    p.db = books[0]
+    print('OK' if ok else 'FAIL')
+
+
+def run_merge_weights_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for merge weights test...')
+    p.open(file)
+    tmp = tempfile.mkdtemp()
+    pgn = os.path.join(tmp, 'partial.pgn')
+    shutil.copy(os.path.splitext(file)[0] + '.pgn', pgn)
+    # Weights of a book that is not full can not be added up, so it is refused
+    partial = json.loads(qx([path, 'book', pgn], stderr=subprocess.DEVNULL))['Book file']
+    merged = os.path.join(tmp, 'merged.bin')
+    out = qx([path, 'merge', merged, partial], stderr=STDOUT).decode()
+    ok = 'Not a full book' in out and not os.path.exists(merged)
+    # Also when the sidecar is gone and the weights alone tell
+    os.remove(os.path.splitext(partial)[0] + '.len')
+    out = qx([path, 'merge', merged, partial], stderr=STDOUT).decode()
+    ok = ok and 'Not a full book' in out and not os.path.exists(merged)
+    # A full book merged alone keeps its weights
+    qx([path, 'merge', merged, p.db, 'full'])
+    db, p.db = p.db, merged
+    weights = lambda r: [(m['move'], m['weight']) for m in r['moves']]
+    ok = ok and weights(p.find(test['input'])) == weights(test['output'])
+    p.db = db
+    shutil.rmtree(tmp)
+    print('OK' if ok else 'FAIL')
+
+
+def run_unsorted_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for unsorted postings test...')
+    p.open(file)
+    # Older books do not sort the posting list of a move by game result
+    with open(p.db, 'rb') as f:
+        data = f.read()
+    entries = [data[i:i + 16] for i in range(0, len(data), 16)]
+    groups = [list(g) for _, g in itertools.groupby(entries, key=lambda e: e[:10])]
+    tmp = tempfile.mkdtemp()
+    book = os.path.join(tmp, 'unsorted.bin')
+    with open(book, 'wb') as f:
+        f.write(b''.join(e for g in groups for e in reversed(g)))
+    stats = lambda r: [[m[k] for k in ('move', 'weight', 'games', 'wins', 'losses', 'draws')]
+                       for m in r['moves']]
+    db, p.db = p.db, book
+    result = p.find(test['input'], limit=1000)
+    ok = stats(result) == stats(test['output'])
+    ok = ok and [sorted(m['pgn offsets']) for m in result['moves']] == \
+                [sorted(m['pgn offsets']) for m in test['output']['moves']]
+    p.db = db
+    shutil.rmtree(tmp)
+    print('OK' if ok else 'FAIL')
+
+
+def run_mph_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for mph test...')
+    p.open(file)
+    result = json.loads(qx([path, 'mph', p.db]))
+    ok = result['Unique positions'] > 0 and os.path.isfile(result['Hash file'])
+    # A book rewritten to the same size must not be probed through the old hash
+    tmp = tempfile.mkdtemp()
+    book = os.path.join(tmp, 'stale.bin')
+    with open(p.db, 'rb') as f:
+        data = f.read()
+    with open(book, 'wb') as f:
+        f.write(data)
+    qx([path, 'mph', book])
+    first = data[:8]
+    n = next(i for i in range(0, len(data), 16) if data[i:i + 8] != first)
+    with open(book, 'wb') as f:
+        f.write(data[n:] + data[-16:] * (n // 16))
+    db, p.db = p.db, book
+    expected = p.find(test['input'])
+    os.remove(os.path.splitext(book)[0] + '.mph')
+    ok = ok and p.find(test['input']) == expected
+    p.db = db
+    shutil.rmtree(tmp)
+    print('OK' if ok else 'FAIL')
+    run_find_test(p, file, test)
+
+
+def run_filter_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for filter test...')
+    pgn = os.path.splitext(file)[0] + '.pgn'
+    # A misspelt or malformed option must fail instead of building without it
+    errors = [qx([path, 'book', pgn, 'full'] + opts, stderr=STDOUT).decode()
+              for opts in (['filtre', '0.01'], ['filter', 'x'])]
+    ok = 'Unknown option filtre' in errors[0] and 'filter false positive' in errors[1]
+    qx([path, 'book', pgn, 'full', 'filter', '0.01'], stderr=STDOUT)
+    p.open(pgn)
+    result = json.loads(qx([path, 'find', p.db, '8/8/8/8/8/8/8/K6k w - - 0 1']))
+    ok = ok and os.path.isfile(os.path.splitext(pgn)[0] + '.flt') and not result['moves']
+    print('OK' if ok else 'FAIL')
+    run_find_test(p, file, test)
+
+
+def run_batch_test(p, file, fens):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for batch test...')
+    p.open(file)
+    single = [p.find(fen) for fen in fens]
+    batch = p.find_batch(fens)
+    by_key = p.find_batch([r['key'] for r in single])
+    by_hex = p.find_batch(['0x{:016x}'.format(r['key']) for r in single])
+    ok = batch == single and [r['moves'] for r in by_key] == [r['moves'] for r in single]
+    ok = ok and by_hex == by_key
+    print('OK' if ok else 'FAIL')
+
+
+def run_explore_test(p, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for explore test...')
+    p.open(file)
+    result = p.explore(test['input'])
+    ok = result['moves'] == p.find(test['input'])['moves']
+    ok = ok and len(result['children']) == 20
+    for c in result['children']:
+        games = sum(m['games'] for m in p.find_batch([c['key']])[0]['moves'])
+        ok = ok and c['games'] == games
+    print('OK' if ok else 'FAIL')
+
+
+def run_line_test(p, file, line):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for line test...')
+    p.open(file)
+    result = p.find_line(line)
+    plies = result['plies']
+    ok = len(plies) == len(line) + 1 and [m['move'] for m in plies[1:]] == line
+    fens = [p.find_batch([m['key']])[0] for m in plies]
+    for m, f in zip(plies, fens):
+        ok = ok and m['games'] == sum(x['games'] for x in f['moves'])
+    leaves = next((m['ply'] for m in plies if not m['games']), None)
+    ok = ok and result['leaves at ply'] == leaves
+    print('OK' if ok else 'FAIL')
+
+
+def run_cursor_test(p, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for cursor test...')
+    p.open(file)
+    full = p.find(test['input'], limit=1000)
+    pages = [p.find(test['input'], limit=2)]
+    while 'cursor' in pages[-1]:
+        pages.append(p.find('', limit=2, cursor=pages[-1]['cursor']))
+    ok = 'cursor' not in full and len(pages) > 1
+    for i, m in enumerate(full['moves']):
+        ofs = sum((pg['moves'][i]['pgn offsets'] for pg in pages), [])
+        skipped = p.find(test['input'], limit=2, skip=2)['moves'][i]['pgn offsets']
+        ok = ok and ofs == m['pgn offsets'] and skipped == m['pgn offsets'][2:4]
+    print('OK' if ok else 'FAIL')
+
+
+def run_serve_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for serve test...')
+    p.open(file)
+    sock = os.path.join(tempfile.mkdtemp(), 'parser.sock')
+    server = subprocess.Popen([path, 'serve', sock, 'threads', '2'],
+                              stdout=subprocess.PIPE)
+    server.stdout.readline()  # Listening once the socket is announced
+    c = Client(sock)
+    ok = all(c.find(p.db, f) == p.find(f) for f in [test['input']] + BATCH_TEST)
+    ok = ok and c.explore(p.db, test['input']) == p.explore(test['input'])
+    ok = ok and c.find_line(p.db, LINE_TEST) == p.find_line(LINE_TEST)
+    try:
+        c.find(p.db, test['input'], limit=0)
+        ok = False
+    except ValueError:
+        pass
+    stats = c.stats()
+    ok = ok and stats['Requests'] == len(BATCH_TEST) + 4 and stats['Errors'] == 1
+    ok = ok and stats['Books mapped'] == 1
+    # A book that cannot be mapped is an error of the request, not of the server
+    bad = os.path.join(os.path.dirname(sock), 'dir.bin')
+    os.mkdir(bad)
+    try:
+        c.find(bad, test['input'])
+        ok = False
+    except ValueError as e:
+        ok = ok and str(e) == 'Could not map ' + bad
+    # A line without end closes the connection once longer than 64 KB
+    c2 = Client(sock)
+    c2.f.write('find ' + 'x' * (65536 - 4))
+    c2.f.flush()
+    ok = ok and c2.f.readline() == 'error 0 Request line too long\n' and c2.f.readline() == ''
+    ok = ok and c.stats()['Requests'] == len(BATCH_TEST) + 6
+    c.close(shutdown=True)
+    ok = ok and server.wait() == 0 and not os.path.exists(sock)
+    print('OK' if ok else 'FAIL')
+
+
+def run_prefetch_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for prefetch test...')
+    p.open(file)
+    sock = os.path.join(tempfile.mkdtemp(), 'parser.sock')
+    server = subprocess.Popen([path, 'serve', sock, 'prefetch', '3'],
+                              stdout=subprocess.PIPE)
+    server.stdout.readline()
+    c = Client(sock)
+    root = c.find(p.db, test['input'])
+    for _ in range(100):  # Prefetching runs in the background
+        if c.stats()['Prefetches'] == min(len(root['moves']), 3):
+            break
+        time.sleep(0.01)
+    child = 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1'
+    hits = c.stats()['Cache hits']
+    ok = c.find(p.db, child) == p.find(child) and c.stats()['Cache hits'] == hits + 1
+    # Live indexes are cached under their own keys, they are not prefetched
+    tmp = tempfile.mkdtemp()
+    pgn = os.path.join(tmp, 'live.pgn')
+    with open(os.path.splitext(file)[0] + '.pgn', 'rb') as f:
+        data = f.read()
+    half = data.find(b'[Event ', len(data) // 2)
+    with open(pgn, 'wb') as f:
+        f.write(data[:half])
+    book = json.loads(qx([path, 'book', pgn, 'full'], stderr=subprocess.DEVNULL))['Book file']
+    with open(pgn, 'ab') as f:
+        f.write(data[half:])
+    c.query('ingest ' + pgn)
+    prefetches = c.stats()['Prefetches']
+    ok = ok and c.find(book, test['input']) == c.find(p.db, test['input'])
+    time.sleep(0.2)
+    ok = ok and c.stats()['Prefetches'] == prefetches
+    shutil.rmtree(tmp)
+    c.close(shutdown=True)
+    ok = ok and server.wait() == 0
+    print('OK' if ok else 'FAIL')
+
+
+def run_http_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for http test...')
+    p.open(file)
+    server = subprocess.Popen([path, 'http', p.db, 'port', '0', 'threads', '2', 'limit', '2'],
+                              stdout=subprocess.PIPE, universal_newlines=True)
+    try:
+        info = ''.join(iter(server.stdout.readline, '}\n')) + '}'
+        url = 'http://127.0.0.1:{}'.format(json.loads(info)['Port'])
+        fen = urllib.parse.quote(test['input'])
+        result = json.loads(urllib.request.urlopen(url + '/explore?fen=' + fen).read())
+        ok = result == p.explore(test['input'], limit=2)  # Clamped by the server
+        page = json.loads(urllib.request.urlopen(url + '/find?limit=1&skip=1&fen=' + fen).read())
+        ok = ok and page == p.find(test['input'], limit=1, skip=1)
+        ofs = sum((m['pgn offsets'] for m in result['moves']), [])
+        ids = ','.join(str(x) for x in ofs)
+        games = json.loads(urllib.request.urlopen(url + '/games?ids=' + ids).read())
+        ok = ok and [g['offset'] for g in games] == ofs
+        ok = ok and all(g['pgn'].startswith('[Event "') and
+                        g['pgn'].count('[Event "') == 1 for g in games)
+        try:
+            urllib.request.urlopen(url + '/games?ids=-1')
+            ok = False
+        except urllib.error.HTTPError as e:
+            ok = ok and e.code == 400
+        # Parameters cannot bring other arguments along
+        for q in ('limit=5%20skip%201&fen=' + fen, 'skip=x&fen=' + fen,
+                  'fen=' + fen + '%20skip%201000000', 'fen=' + fen + '%20cursor%20ab'):
+            try:
+                urllib.request.urlopen(url + '/find?' + q)
+                ok = False
+            except urllib.error.HTTPError as e:
+                ok = ok and e.code == 400
+    finally:
+        server.terminate()
+        server.wait()
+    print('OK' if ok else 'FAIL')
+
+
+def run_tagged_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for tagged test...')
+    p.open(os.path.splitext(file)[0] + '.pgn')
+    # Rebuild a copy, a book must not be rewritten while being queried
+    pgn = os.path.join(tempfile.mkdtemp(), os.path.basename(p.pgn))
+    shutil.copy(p.pgn, pgn)
+    cmds = ['tagged threads 4', 'b book {} full'.format(pgn)]
+    cmds += ['{} find {} {}'.format(i, p.db, f) for i, f in enumerate(BATCH_TEST)]
+    cmds += ['r isready', 'x bogus', 'quit']
+    # Clients like chess_db.py read stderr merged with the protocol
+    out = qx([path], input='\n'.join(cmds) + '\n', universal_newlines=True,
+             stderr=STDOUT)
+    responses = {}
+    for line in out.splitlines():
+        tag, text = line.split(' ', 1)
+        responses.setdefault(tag, []).append(text)
+    ok = len(responses) == len(BATCH_TEST) + 3
+    for i, f in enumerate(BATCH_TEST):
+        r = responses[str(i)]
+        ok = ok and r[-1].startswith('ok ') and json.loads('\n'.join(r[:-1])) == p.find(f)
+    ok = ok and responses['r'][0] == 'readyok' and responses['x'][-1].startswith('error ')
+    book = json.loads('\n'.join(responses['b'][:-1]))
+    ok = ok and book['Book file'] == os.path.splitext(pgn)[0] + '.bin'
+    ok = ok and book['Games'] == DB[fname]['games']
+    shutil.rmtree(os.path.dirname(pgn))
+    print('OK' if ok else 'FAIL')
+
+
+def run_async_test(p, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for async test...')
+    p.open(os.path.splitext(file)[0] + '.pgn')
+    expected = p.find(test['input'])
+    pgn = p.pgn
+    p.pgn = os.path.join(tempfile.mkdtemp(), os.path.basename(pgn))
+    shutil.copy(pgn, p.pgn)
+    job = p.make(wait=False)
+    ok = p.find(test['input']) == expected  # Served while building
+    status = p.status(job)
+    while status['Stage'] not in ('done', 'failed'):
+        status = p.status(job)
+    ok = ok and status['Stage'] == 'done' and status['ETA (ms)'] == 0
+    ok = ok and status['Bytes parsed'] == os.path.getsize(pgn)
+    ok = ok and status['Games'] == status['Result']['Games'] == DB[fname]['games']
+    shutil.rmtree(os.path.dirname(p.pgn))
+    p.pgn = pgn
+    print('OK' if ok else 'FAIL')
+
+
+def run_cache_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for cache test...')
+    p.open(os.path.splitext(file)[0] + '.pgn')
+    expected = p.find(test['input'])
+    # A book rebuilt out of another PGN must not be answered from the cache
+    pgn = os.path.join(tempfile.mkdtemp(), 'cache.pgn')
+    shutil.copy(os.path.join(os.path.dirname(file), 'GM_games.pgn'), pgn)
+    c = Parser(path)
+    c.open(pgn)
+    c.find(test['input'])
+    stale = c.find(test['input'])
+    shutil.copy(p.pgn, pgn)
+    c.make()
+    ok = c.find(test['input']) == expected and stale != expected
+    ok = ok and c.find(test['input']) == expected
+    stats = c.stats()
+    ok = ok and stats['Cache hits'] == 2 and stats['Cache misses'] == 2
+    c.close()
+    shutil.rmtree(os.path.dirname(pgn))
+    print('OK' if ok else 'FAIL')
+
+
+def run_hot_test(p, path, file, test):
+    fname = os.path.basename(file)
+    fname = os.path.splitext(fname)[0]
+    sys.stdout.write('Processing ' + fname + ' for hot test...')
+    p.open(file)
+    fens = [test['input']] + BATCH_TEST
+    expected = [(p.find(f, limit=3), p.find(f, limit=2, skip=4)) for f in fens]
+    pgn = os.path.join(tempfile.mkdtemp(), os.path.basename(file))
+    shutil.copy(os.path.splitext(file)[0] + '.pgn', os.path.splitext(pgn)[0] + '.pgn')
+    c = Parser(path)
+    c.open(os.path.splitext(pgn)[0] + '.pgn')
+    c.make(full=True, hot=(10, 5))
+    result = [(c.find(f, limit=3), c.find(f, limit=2, skip=4)) for f in fens]
+    ok = result == expected and c.explore(test['input']) == p.explore(test['input'])
+    ok = ok and os.path.isfile(os.path.splitext(pgn)[0] + '.hot')
+    ok = ok and c.stats()['Hot table hits'] > 0
+    c.close()
+    shutil.rmtree(os.path.dirname(pgn))
+    print('OK' if ok else 'FAIL')
+
+
 def run_find_test(p, file, test):
     fname = os.path.basename(file)
     fname = os.path.splitext(fname)[0]
@@ -138,6 +873,87 @@ if __name__ == "__main__":
     for fname, item in FIND_TEST.items():
         run_find_test(p, args.dir + fname, item)
 
+    for fname, item in FIND_TEST.items():
+        run_cursor_test(p, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_explore_test(p, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_line_test(p, args.dir + fname, LINE_TEST)
+
+    for fname, item in FIND_TEST.items():
+        run_batch_test(p, args.dir + fname, BATCH_TEST)
+
+    for fname, item in FIND_TEST.items():
+        run_federated_test(p, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_append_test(p, args.path, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_merge_test(p, args.path, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_merge_weights_test(p, args.path, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_unsorted_test(p, args.path, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_resume_test(p, args.path, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_prune_test(p, args.path, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_archive_test(p, args.path, args.dir + fname, item)
+
+    run_lan_test(p, args.path)
+
+    for fname, item in FIND_TEST.items():
+        run_live_test(p, args.path, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_follow_test(p, args.path, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_reload_test(p, args.path, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_shard_test(p, args.path, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_reduce_test(p, args.path, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_mph_test(p, args.path, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_filter_test(p, args.path, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_hot_test(p, args.path, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_cache_test(p, args.path, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_async_test(p, args.dir + fname, item)
+
+    for fname, item in FIND_TEST.items():
+        run_tagged_test(p, args.path, args.dir + fname, item)
+
+    if 'nt' not in os.name:
+        for fname, item in FIND_TEST.items():
+            run_serve_test(p, args.path, args.dir + fname, item)
+
+        for fname, item in FIND_TEST.items():
+            run_prefetch_test(p, args.path, args.dir + fname, item)
+
+        for fname, item in FIND_TEST.items():
+            run_http_test(p, args.path, args.dir + fname, item)
+
     print("\ngames {}, moves {}, fixed {}\n"
           .format(stats['games'], stats['moves'], stats['fixed']))
 
@@ -0,0 +1,88 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "thread.h"
+
+using namespace std;
+
+/// ThreadPool::ThreadPool() launches the given number of worker threads, at
+/// least one, that wait for tasks in idle_loop().
+
+ThreadPool::ThreadPool(size_t threads) {
+
+  for (size_t i = 0; i < max(threads, size_t(1)); ++i)
+      workers.emplace_back(&ThreadPool::idle_loop, this);
+}
+
+
+/// ThreadPool::~ThreadPool() lets the workers drain the queue, then joins them
+
+ThreadPool::~ThreadPool() {
+
+  {
+      unique_lock<std::mutex> lk(mutex);
+      exit = true;
+  }
+
+  sleepCondition.notify_all();
+
+  for (thread& th : workers)
+      th.join();
+}
+
+
+/// ThreadPool::submit() queues a task and wakes up an idle worker to run it
+
+void ThreadPool::submit(function<void()> task) {
+
+  {
+      unique_lock<std::mutex> lk(mutex);
+      tasks.push_back(move(task));
+  }
+
+  sleepCondition.notify_one();
+}
+
+
+/// ThreadPool::idle_loop() is where the workers park when there is nothing to
+/// do. Tasks run outside the lock, so that they can submit further tasks.
+
+void ThreadPool::idle_loop() {
+
+  while (true)
+  {
+      function<void()> task;
+
+      {
+          unique_lock<std::mutex> lk(mutex);
+          sleepCondition.wait(lk, [&]{ return exit || !tasks.empty(); });
+
+          if (tasks.empty())
+              return;
+
+          task = move(tasks.front());
+          tasks.pop_front();
+      }
+
+      task();
+  }
+}
@@ -18,19 +18,36 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <chrono>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include "movegen.h"
 #include "position.h"
+#include "server.h"
+#include "thread.h"
 #include "uci.h"
 
 using namespace std;
 
 namespace Parser {
-    void make_book(istringstream& is);
-    void find(istringstream& is);
+    string make_book(istringstream& is, ostream& os);
+    string make_hash(istringstream& is, ostream& os);
+    string merge(istringstream& is, ostream& os);
+    string reduce(istringstream& is, ostream& os);
+    string ingest(istringstream& is, ostream& os);
+    string status(istringstream& is, ostream& os);
+    string cache(istringstream& is, ostream& os);
+    string stats(istringstream& is, ostream& os);
+    string find(istringstream& is, ostream& os);
+    string find_batch(istringstream& is, ostream& os);
+    string explore(istringstream& is, ostream& os);
+    string find_line(istringstream& is, ostream& os);
+    string games(istringstream& is, ostream& os);
 }
 
 namespace {
@@ -78,6 +95,138 @@ namespace {
     }
   }
 
+
+  // Commands that write their result to a stream and return an error message,
+  // empty on success. They can run on any thread.
+  typedef string (*Command)(istringstream& is, ostream& os);
+
+  const map<string, Command> Commands = {
+      { "book",      Parser::make_book  },
+      { "mph",       Parser::make_hash  },
+      { "merge",     Parser::merge      },
+      { "reduce",    Parser::reduce     },
+      { "ingest",    Parser::ingest     },
+      { "status",    Parser::status     },
+      { "cache",     Parser::cache      },
+      { "stats",     Parser::stats      },
+      { "find",      Parser::find       },
+      { "findbatch", Parser::find_batch },
+      { "explore",   Parser::explore    },
+      { "findline",  Parser::find_line  },
+      { "games",     Parser::games      }
+  };
+
+
+  // tagged() is the loop of the tagged protocol, started by the "tagged"
+  // command. Each request line starts with an id, the following text is a
+  // command that runs on a pool of worker threads, so that a slow command does
+  // not hold back the next ones. Each line of the output is prefixed by the id
+  // of its request, and is followed by a status line, "<id> ok <usec>" or "<id>
+  // error <usec> <message>". Responses of different requests can come in any
+  // order, but are never interleaved. "isready" is answered at once. Progress
+  // logs of commands are dropped, as clients often merge stderr with stdout.
+
+  void tagged(istringstream& is) {
+
+    string token, cmd, id;
+    size_t threads = max(std::thread::hardware_concurrency(), 1U);
+    mutex ioMutex;
+
+    while (is >> token)
+        if (token == "threads")
+            is >> threads;
+
+    auto respond = [&](const string& tag, const string& output,
+                       const string& error, uint64_t usec) {
+
+        istringstream lines(output);
+        stringstream ss;
+        string line;
+
+        while (getline(lines, line))
+            ss << tag << " " << line << "\n";
+
+        ss << tag << (error.empty() ? " ok " : " error ") << usec
+           << (error.empty() ? "" : " " + error) << "\n";
+
+        lock_guard<mutex> lock(ioMutex);
+        cout << ss.str() << flush;
+    };
+
+    // Restored once the pool below has waited for the requests in flight
+    struct MuteLog {
+      streambuf* buf = cerr.rdbuf(nullptr);
+     ~MuteLog() { cerr.rdbuf(buf); }
+    } mute;
+
+    ThreadPool pool(threads);
+
+    while (getline(cin, cmd))
+    {
+        istringstream ls(cmd);
+        id.clear(), token.clear();
+        ls >> skipws >> id >> token;
+
+        if (id == "quit" || token == "quit")
+            break;
+
+        if (id.empty())
+            continue;
+
+        if (token == "isready")
+        {
+            respond(id, "readyok", "", 0);
+            continue;
+        }
+
+        auto it = Commands.find(token);
+
+        if (it == Commands.end())
+        {
+            respond(id, "", "Unknown command: " + token, 0);
+            continue;
+        }
+
+        string args;
+        getline(ls, args);
+
+        // Positions of a batch, when not read from a file, follow the request
+        // up to an "end" line, as with the untagged "findbatch".
+        if (token == "findbatch")
+        {
+            istringstream as(args);
+            string a;
+            int files = -1; // The first argument is the book
+
+            while (as >> a)
+                if (a == "limit" || a == "skip")
+                    as >> a;
+                else
+                    files++;
+
+            if (!files)
+            {
+                for (string line; getline(cin, line) && line.compare(0, 3, "end"); )
+                    args += "\n" + line;
+
+                args += "\nend"; // Never fall back to stdin
+            }
+        }
+
+        Command command = it->second;
+
+        pool.submit([=, &respond]{
+            auto start = chrono::steady_clock::now();
+            istringstream args_is(args);
+            stringstream os;
+            string error = command(args_is, os);
+            uint64_t usec = chrono::duration_cast<chrono::microseconds>(
+                            chrono::steady_clock::now() - start).count();
+            respond(id, os.str(), error, usec);
+        });
+    }
+  } // Wait for the requests in flight
+
 } // namespace
 
 
@@ -107,11 +256,18 @@ void UCI::loop(int argc, char* argv[]) {
       is >> skipws >> token;
 
       if (token == "quit") {}
-      else if (token == "position") position(pos, is);
-      else if (token == "d")        std::cerr << pos << std::endl;
-      else if (token == "book")     Parser::make_book(is);
-      else if (token == "find")     Parser::find(is);
-      else if (token == "isready")  std::cout << "readyok" << std::endl;
+      else if (token == "position")  position(pos, is);
+      else if (token == "d")         std::cerr << pos << std::endl;
+      else if (token == "serve")     Server::serve(is);
+      else if (token == "http")      Server::http(is);
+      else if (token == "tagged")    tagged(is);
+      else if (token == "isready")   std::cout << "readyok" << std::endl;
+      else if (Commands.count(token))
+      {
+          string error = Commands.at(token)(is, cout);
+          if (!error.empty())
+              std::cerr << error << std::endl;
+      }
       else
           std::cerr << "Unknown command: " << cmd << std::endl;
 